@@ -0,0 +1,372 @@
+// Host side of the lib_i2c bridge.
+//
+// lib_i2c (built with I2C_BRIDGE, with i2c_bridge_poll() in the main loop)
+// keeps a mailbox in RAM.  A batch of pings, reads and writes is written into
+// it with WriteBinaryBlob, run by the target, and the results and read data
+// are fetched back with ReadBinaryBlob.  Every batch costs a few halt/resume
+// round trips on the debug link, so as many operations as the mailbox holds
+// are packed into each one.
+//
+// The layout here MUST match i2c_bridge_t in lib_i2c.h:
+//   uint32_t magic, uint16_t max_ops, uint16_t max_data, uint32_t request,
+//   uint32_t done, uint16_t count, uint16_t reserved
+//   then [max_ops] operations of:
+//   uint8_t cmd, uint8_t bus, uint8_t addr, uint8_t reg, uint8_t len,
+//   uint8_t err, uint16_t offset
+//   then [max_data] bytes of data.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "minichlink.h"
+
+#define I2C_BRIDGE_MAGIC       0x4D433249
+#define I2C_BRIDGE_HEADER_SIZE 20
+#define I2C_BRIDGE_OP_SIZE     8
+#define I2C_BRIDGE_TIMEOUT_MS  1000
+
+#define I2C_BRIDGE_PING  0
+#define I2C_BRIDGE_READ  1
+#define I2C_BRIDGE_WRITE 2
+
+static const char * i2c_bridge_errors[] = { "OK", "BERR", "NACK", "ARLO", "OVR", "BUSY", "VERIFY", "INVALID" };
+
+struct I2CBridge
+{
+	void * dev;
+	uint32_t base;      // Mailbox address on the target
+	int bus;            // 0 for i2c_bus1, 1 for i2c_bus2
+	int max_ops;
+	int max_data;
+	uint32_t request;
+	int count;          // Operations queued in this batch
+	int used;           // Data bytes queued in this batch
+	uint8_t * ops;
+	uint8_t * data;
+};
+
+static uint32_t BridgeLE32( const uint8_t * p ) { return p[0] | (p[1]<<8) | (p[2]<<16) | ((uint32_t)p[3]<<24); }
+static uint16_t BridgeLE16( const uint8_t * p ) { return p[0] | (p[1]<<8); }
+
+static void BridgePut32( uint8_t * p, uint32_t v )
+{
+	p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static const char * BridgeError( int err )
+{
+	return ( err < sizeof( i2c_bridge_errors ) / sizeof( i2c_bridge_errors[0] ) ) ? i2c_bridge_errors[err] : "?";
+}
+
+static void BridgeHalt( struct I2CBridge * b, int halt )
+{
+	if( MCF.HaltMode ) MCF.HaltMode( b->dev, halt ? HALT_MODE_HALT_BUT_NO_RESET : HALT_MODE_RESUME );
+}
+
+static int BridgeOpen( void * dev, uint32_t address, int bus, struct I2CBridge * b )
+{
+	uint8_t header[I2C_BRIDGE_HEADER_SIZE];
+	memset( b, 0, sizeof( *b ) );
+	b->dev = dev;
+	b->bus = bus;
+
+	BridgeHalt( b, 1 );
+	int r = I2CLocate( dev, address, I2C_BRIDGE_MAGIC, &b->base );
+	if( !r ) r = MCF.ReadBinaryBlob( dev, b->base, I2C_BRIDGE_HEADER_SIZE, header ) < 0;
+	BridgeHalt( b, 0 );
+	if( r )
+	{
+		fprintf( stderr, "Error: Could not find an I2C bridge mailbox (is lib_i2c built with I2C_BRIDGE?)\n" );
+		return -9;
+	}
+
+	b->max_ops = BridgeLE16( header + 4 );
+	b->max_data = BridgeLE16( header + 6 );
+	b->request = BridgeLE32( header + 8 );
+	if( b->max_ops == 0 || b->max_data == 0 )
+	{
+		fprintf( stderr, "Error: I2C bridge mailbox at %08x is corrupt\n", b->base );
+		return -9;
+	}
+
+	b->ops = malloc( b->max_ops * I2C_BRIDGE_OP_SIZE );
+	b->data = malloc( b->max_data );
+	return 0;
+}
+
+static void BridgeClose( struct I2CBridge * b )
+{
+	free( b->ops );
+	free( b->data );
+}
+
+// Queues one operation.  Returns its index, or -1 if the batch is full.
+static int BridgeAdd( struct I2CBridge * b, int cmd, int addr, int reg, int len, const uint8_t * wdata )
+{
+	if( b->count == b->max_ops || b->used + len > b->max_data ) return -1;
+
+	uint8_t * op = b->ops + b->count * I2C_BRIDGE_OP_SIZE;
+	op[0] = cmd;
+	op[1] = b->bus;
+	op[2] = addr;
+	op[3] = reg;
+	op[4] = len;
+	op[5] = 0xff;
+	op[6] = b->used;
+	op[7] = b->used >> 8;
+	if( wdata ) memcpy( b->data + b->used, wdata, len );
+	b->used += len;
+	return b->count++;
+}
+
+static int BridgeResult( struct I2CBridge * b, int idx )
+{
+	return b->ops[idx * I2C_BRIDGE_OP_SIZE + 5];
+}
+
+static uint8_t * BridgeData( struct I2CBridge * b, int idx )
+{
+	return b->data + BridgeLE16( b->ops + idx * I2C_BRIDGE_OP_SIZE + 6 );
+}
+
+// Sends the queued batch, waits for the target to run it, then reads the
+// results back.  The request count is written last, so the target never sees
+// half a batch.
+static int BridgeRun( struct I2CBridge * b )
+{
+	void * dev = b->dev;
+	uint32_t ops_addr = b->base + I2C_BRIDGE_HEADER_SIZE;
+	uint32_t data_addr = ops_addr + b->max_ops * I2C_BRIDGE_OP_SIZE;
+	uint8_t word[4];
+	int r = 0;
+
+	if( b->count == 0 ) return 0;
+
+	BridgeHalt( b, 1 );
+	if( b->used ) r |= MCF.WriteBinaryBlob( dev, data_addr, b->used, b->data );
+	r |= MCF.WriteBinaryBlob( dev, ops_addr, b->count * I2C_BRIDGE_OP_SIZE, b->ops );
+	word[0] = b->count; word[1] = b->count >> 8; word[2] = word[3] = 0;
+	r |= MCF.WriteBinaryBlob( dev, b->base + 16, 4, word );
+	BridgePut32( word, ++b->request );
+	r |= MCF.WriteBinaryBlob( dev, b->base + 8, 4, word );
+	BridgeHalt( b, 0 );
+	if( r ) return -12;
+
+	// Give the bus time to move the bytes at 100kHz before the first check,
+	// each check halts the core
+	MCF.DelayUS( dev, ( b->used + 3 * b->count ) * 90 );
+
+	int ms;
+	for( ms = 0; ms < I2C_BRIDGE_TIMEOUT_MS; ms++ )
+	{
+		BridgeHalt( b, 1 );
+		r = MCF.ReadBinaryBlob( dev, b->base + 12, 4, word ) < 0;
+		BridgeHalt( b, 0 );
+		if( r ) return -12;
+		if( BridgeLE32( word ) == b->request ) break;
+		MCF.DelayUS( dev, 1000 );
+	}
+	if( ms == I2C_BRIDGE_TIMEOUT_MS )
+	{
+		fprintf( stderr, "Error: The target did not run the batch (is i2c_bridge_poll() being called?)\n" );
+		return -9;
+	}
+
+	BridgeHalt( b, 1 );
+	r |= MCF.ReadBinaryBlob( dev, ops_addr, b->count * I2C_BRIDGE_OP_SIZE, b->ops ) < 0;
+	if( b->used ) r |= MCF.ReadBinaryBlob( dev, data_addr, b->used, b->data ) < 0;
+	BridgeHalt( b, 0 );
+	return r ? -12 : 0;
+}
+
+static void BridgeReset( struct I2CBridge * b )
+{
+	b->count = 0;
+	b->used = 0;
+}
+
+// Largest single read, limited by the op length field and the mailbox.
+static int BridgeChunk( struct I2CBridge * b )
+{
+	return ( b->max_data < 255 ) ? b->max_data : 255;
+}
+
+static int BridgeDetect( struct I2CBridge * b )
+{
+	int addr = 0x08, first, i;
+
+	printf( "     0  1  2  3  4  5  6  7  8  9  a  b  c  d  e  f\n00:                        " );
+	while( addr < 0x78 )
+	{
+		// Ping as many addresses as fit in one batch
+		first = addr;
+		while( addr < 0x78 && BridgeAdd( b, I2C_BRIDGE_PING, addr, 0, 0, 0 ) >= 0 ) addr++;
+		if( BridgeRun( b ) ) return -9;
+
+		for( i = 0; i < b->count; i++ )
+		{
+			int a = first + i;
+			if( ( a & 0x0f ) == 0 ) printf( "\n%02x:", a );
+			if( BridgeResult( b, i ) == 0 ) printf( " %02x", a );
+			else printf( " --" );
+		}
+		BridgeReset( b );
+	}
+	printf( "\n" );
+	return 0;
+}
+
+// Reads [len] registers from [reg] into [out], in as few batches as fit.
+static int BridgeReadRange( struct I2CBridge * b, int addr, int reg, int len, uint8_t * out )
+{
+	int chunk = BridgeChunk( b );
+	int done = 0;
+
+	while( done < len )
+	{
+		int queued = done, i;
+		while( queued < len )
+		{
+			int n = ( len - queued < chunk ) ? len - queued : chunk;
+			if( BridgeAdd( b, I2C_BRIDGE_READ, addr, ( reg + queued ) & 0xff, n, 0 ) < 0 ) break;
+			queued += n;
+		}
+		if( BridgeRun( b ) ) return -9;
+
+		for( i = 0; i < b->count; i++ )
+		{
+			int err = BridgeResult( b, i );
+			if( err )
+			{
+				fprintf( stderr, "Error: Read of 0x%02x reg 0x%02x failed: %s\n", addr, ( reg + done ) & 0xff, BridgeError( err ) );
+				BridgeReset( b );
+				return -9;
+			}
+			int n = b->ops[i * I2C_BRIDGE_OP_SIZE + 4];
+			memcpy( out + done, BridgeData( b, i ), n );
+			done += n;
+		}
+		BridgeReset( b );
+	}
+	return 0;
+}
+
+static int BridgeGet( struct I2CBridge * b, int argc, char ** argv )
+{
+	if( argc < 3 )
+	{
+		fprintf( stderr, "Error: get needs an address and a register.\n" );
+		return -1;
+	}
+	int addr = SimpleReadNumberInt( argv[1], 0 );
+	int reg = SimpleReadNumberInt( argv[2], 0 );
+	int len = ( argc > 3 ) ? SimpleReadNumberInt( argv[3], 1 ) : 1;
+	if( len < 1 || len > 256 )
+	{
+		fprintf( stderr, "Error: get reads 1 to 256 registers.\n" );
+		return -1;
+	}
+
+	uint8_t buf[256];
+	if( BridgeReadRange( b, addr, reg, len, buf ) ) return -9;
+
+	int i;
+	for( i = 0; i < len; i++ )
+		printf( "0x%02x%s", buf[i], ( ( i & 0x0f ) == 0x0f || i == len - 1 ) ? "\n" : " " );
+	return 0;
+}
+
+static int BridgeSet( struct I2CBridge * b, int argc, char ** argv )
+{
+	if( argc < 4 )
+	{
+		fprintf( stderr, "Error: set needs an address, a register and at least one byte.\n" );
+		return -1;
+	}
+	int addr = SimpleReadNumberInt( argv[1], 0 );
+	int reg = SimpleReadNumberInt( argv[2], 0 );
+	int len = argc - 3;
+	if( len > BridgeChunk( b ) )
+	{
+		fprintf( stderr, "Error: set can write at most %d bytes.\n", BridgeChunk( b ) );
+		return -1;
+	}
+
+	uint8_t buf[255];
+	int i;
+	for( i = 0; i < len; i++ )
+		buf[i] = SimpleReadNumberInt( argv[3 + i], 0 );
+
+	BridgeAdd( b, I2C_BRIDGE_WRITE, addr, reg, len, buf );
+	if( BridgeRun( b ) ) return -9;
+
+	int err = BridgeResult( b, 0 );
+	BridgeReset( b );
+	if( err )
+	{
+		fprintf( stderr, "Error: Write to 0x%02x reg 0x%02x failed: %s\n", addr, reg, BridgeError( err ) );
+		return -9;
+	}
+	return 0;
+}
+
+static int BridgeDump( struct I2CBridge * b, int argc, char ** argv )
+{
+	if( argc < 2 )
+	{
+		fprintf( stderr, "Error: dump needs an address.\n" );
+		return -1;
+	}
+	int addr = SimpleReadNumberInt( argv[1], 0 );
+
+	uint8_t buf[256];
+	if( BridgeReadRange( b, addr, 0, 256, buf ) ) return -9;
+
+	int row, col;
+	printf( "     0  1  2  3  4  5  6  7  8  9  a  b  c  d  e  f    0123456789abcdef\n" );
+	for( row = 0; row < 256; row += 16 )
+	{
+		printf( "%02x:", row );
+		for( col = 0; col < 16; col++ )
+			printf( " %02x", buf[row + col] );
+		printf( "    " );
+		for( col = 0; col < 16; col++ )
+		{
+			uint8_t c = buf[row + col];
+			printf( "%c", ( c >= 0x20 && c < 0x7f ) ? c : '.' );
+		}
+		printf( "\n" );
+	}
+	return 0;
+}
+
+int I2CBridgeCommand( void * dev, uint32_t address, int bus, int argc, char ** argv )
+{
+	if( !MCF.ReadBinaryBlob || !MCF.WriteBinaryBlob || !MCF.DelayUS ) return -1;
+	if( argc < 1 )
+	{
+		fprintf( stderr, "Error: -I needs a command: detect, get, set or dump.\n" );
+		return -1;
+	}
+
+	struct I2CBridge b;
+	int r = BridgeOpen( dev, address, bus - 1, &b );
+	if( r ) return r;
+
+	if( strcmp( argv[0], "detect" ) == 0 )
+		r = BridgeDetect( &b );
+	else if( strcmp( argv[0], "get" ) == 0 )
+		r = BridgeGet( &b, argc, argv );
+	else if( strcmp( argv[0], "set" ) == 0 )
+		r = BridgeSet( &b, argc, argv );
+	else if( strcmp( argv[0], "dump" ) == 0 )
+		r = BridgeDump( &b, argc, argv );
+	else
+	{
+		fprintf( stderr, "Error: Unknown I2C command \"%s\"\n", argv[0] );
+		r = -1;
+	}
+
+	BridgeClose( &b );
+	return r;
+}
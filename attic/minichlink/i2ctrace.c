@@ -0,0 +1,497 @@
+// Decoder for the lib_i2c binary transaction trace.
+//
+// lib_i2c (built with I2C_TRACE) keeps a ring of 8 byte records in RAM. This
+// reads the ring through ReadBinaryBlob, without the target needing to print
+// anything, then pretty-prints it or exports it as CSV for offline analysis.
+//
+// The layout here MUST match i2c_trace_t in lib_i2c.h:
+//   uint32_t magic, uint16_t depth, uint8_t ticks_per_us, uint8_t rec_size,
+//   uint32_t head, then [depth] records of [rec_size] bytes:
+//   uint32_t timestamp, uint8_t addr, uint8_t reg, uint8_t len, uint8_t status
+//   and with I2C_TRACE_TIMING:
+//   uint16_t ckcfgr, uint8_t pclk_mhz, uint8_t bytes, uint32_t ticks[6] (one
+//   per phase).  Older targets kept uint16_t ckcfgr, uint16_t ticks[6],
+//   uint8_t pclk_mhz, pad - 24 bytes, with the ticks saturating at 0xFFFF.
+//
+// Timed traces can also be exported as a VCD waveform.  The SCL/SDA edges are
+// modelled from CKCFGR and the I2C input clock, and placed inside the phase
+// times the target measured, so the idle gaps software adds between START,
+// address, data and STOP show up as stretches of SCL held low.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "minichlink.h"
+
+#define I2C_TRACE_MAGIC       0x54433249
+#define I2C_TRACE_HEADER_SIZE 12
+#define I2C_TRACE_RECORD_SIZE 8
+#define I2C_TRACE_TIMED_SIZE   36
+#define I2C_TRACE_TIMED16_SIZE 24
+#define I2C_TRACE_PHASES      6
+
+static const char * i2c_trace_errors[] = { "OK", "BERR", "NACK", "ARLO", "OVR", "BUSY", "VERIFY", "INVALID" };
+static const char * i2c_trace_phases[] = { "IDLE", "START", "ADDR", "REG", "RESTART", "DATA", "DONE" };
+
+static uint32_t TraceLE32( const uint8_t * p ) { return p[0] | (p[1]<<8) | (p[2]<<16) | ((uint32_t)p[3]<<24); }
+static uint16_t TraceLE16( const uint8_t * p ) { return p[0] | (p[1]<<8); }
+
+static const char * TraceError( int err )
+{
+	return ( err < sizeof( i2c_trace_errors ) / sizeof( i2c_trace_errors[0] ) ) ? i2c_trace_errors[err] : "?";
+}
+
+static const char * TracePhase( int phase )
+{
+	return ( phase < sizeof( i2c_trace_phases ) / sizeof( i2c_trace_phases[0] ) ) ? i2c_trace_phases[phase] : "?";
+}
+
+// Older targets kept a 16 bit ticks_per_us here, so a 0 means plain records.
+static uint32_t TraceRecordSize( const uint8_t * header )
+{
+	return header[7] ? header[7] : I2C_TRACE_RECORD_SIZE;
+}
+
+// SCL low and high times in ns for a CKCFGR value, with the I2C peripheral
+// clocked at [pclk_mhz].  Returns 0 if the timing is not known.
+static int TraceSCLTiming( uint16_t ckcfgr, int pclk_mhz, double * low_ns, double * high_ns )
+{
+	int ccr = ckcfgr & 0x0fff;
+	if( ccr == 0 || pclk_mhz == 0 ) return 0;
+
+	int low = ccr, high = ccr;
+	if( ckcfgr & 0x8000 )  // Fast Mode, DUTY picks 16:9 or 2:1
+	{
+		low  = ( ckcfgr & 0x4000 ) ? 16 * ccr : 2 * ccr;
+		high = ( ckcfgr & 0x4000 ) ?  9 * ccr : ccr;
+	}
+	*low_ns  = low  * 1000.0 / pclk_mhz;
+	*high_ns = high * 1000.0 / pclk_mhz;
+	return 1;
+}
+
+// Time the bus itself needs for [phase] of a record, in ns, ignoring any
+// software delays.  [bytes] is the number of data bytes moved.
+static double TraceWireNs( int phase, int bytes, double low_ns, double high_ns )
+{
+	double bit = low_ns + high_ns;
+	switch( phase )
+	{
+	case 1: return high_ns;                  // START hold
+	case 2: return 9 * bit;                  // Address and ACK
+	case 3: return 9 * bit;                  // Register and ACK
+	case 4: return bit + 9 * bit;            // Repeated START, Read Address
+	case 5: return 9 * bit * bytes;          // Data and ACKs
+	}
+	return 0;
+}
+
+// Finds a lib_i2c structure that starts with [magic].  If [address] does not
+// hold it, all of RAM is searched.  Returns 0 and fills in [found] on success.
+// Shared with the bridge in i2cbridge.c.
+int I2CLocate( void * dev, uint32_t address, uint32_t magic, uint32_t * found )
+{
+	struct InternalState * iss = (struct InternalState*)(((struct ProgrammerStructBase*)dev)->internal);
+	uint8_t word[4];
+
+	if( MCF.ReadBinaryBlob( dev, address, 4, word ) >= 0 && TraceLE32( word ) == magic )
+	{
+		*found = address;
+		return 0;
+	}
+
+	uint8_t * ram = malloc( iss->ram_size );
+	if( MCF.ReadBinaryBlob( dev, iss->ram_base, iss->ram_size, ram ) < 0 )
+	{
+		free( ram );
+		return -12;
+	}
+
+	int i;
+	for( i = 0; i + 4 <= iss->ram_size; i += 4 )
+	{
+		if( TraceLE32( ram + i ) == magic )
+		{
+			*found = iss->ram_base + i;
+			free( ram );
+			return 0;
+		}
+	}
+
+	free( ram );
+	return -1;
+}
+
+// Reads the trace header and record ring into [header] and a newly allocated
+// [recs] buffer.  Returns 0 on success.
+static int I2CTraceRead( void * dev, uint32_t address, uint32_t * trace_addr, uint8_t * header, uint8_t ** recs )
+{
+	if( I2CLocate( dev, address, I2C_TRACE_MAGIC, trace_addr ) )
+	{
+		fprintf( stderr, "Error: Could not find an I2C trace ring (is lib_i2c built with I2C_TRACE?)\n" );
+		return -9;
+	}
+
+	if( MCF.ReadBinaryBlob( dev, *trace_addr, I2C_TRACE_HEADER_SIZE, header ) < 0 ) return -12;
+
+	uint32_t depth = TraceLE16( header + 4 );
+	uint32_t ticks_per_us = header[6];
+	uint32_t rec_size = TraceRecordSize( header );
+	if( depth == 0 || ( depth & ( depth - 1 ) ) || ticks_per_us == 0 || rec_size < I2C_TRACE_RECORD_SIZE )
+	{
+		fprintf( stderr, "Error: I2C trace header at %08x is corrupt\n", *trace_addr );
+		return -9;
+	}
+
+	*recs = malloc( depth * rec_size );
+	if( MCF.ReadBinaryBlob( dev, *trace_addr + I2C_TRACE_HEADER_SIZE, depth * rec_size, *recs ) < 0 )
+	{
+		free( *recs );
+		return -12;
+	}
+	return 0;
+}
+
+// One decoded trace record.
+struct TraceRecord
+{
+	uint32_t ts;
+	int addr, read, reg, len, err, phase;
+	int timed;
+	uint16_t ckcfgr;
+	int pclk_mhz;
+	int bytes;  // -1 if the record does not say
+	uint32_t ticks[I2C_TRACE_PHASES];
+};
+
+static void TraceDecode( const uint8_t * r, uint32_t rec_size, struct TraceRecord * t )
+{
+	t->ts = TraceLE32( r );
+	t->addr = r[4] & 0x7f;
+	t->read = r[4] >> 7;
+	t->reg = r[5];
+	t->len = r[6];
+	t->err = r[7] >> 4;
+	t->phase = r[7] & 0x0f;
+	t->bytes = -1;
+	t->timed = rec_size >= I2C_TRACE_TIMED16_SIZE;
+	if( !t->timed ) return;
+
+	t->ckcfgr = TraceLE16( r + 8 );
+	int i;
+	if( rec_size >= I2C_TRACE_TIMED_SIZE )
+	{
+		t->pclk_mhz = r[10];
+		t->bytes = r[11];
+		for( i = 0; i < I2C_TRACE_PHASES; i++ )
+			t->ticks[i] = TraceLE32( r + 12 + i * 4 );
+	}
+	else
+	{
+		for( i = 0; i < I2C_TRACE_PHASES; i++ )
+			t->ticks[i] = TraceLE16( r + 10 + i * 2 );
+		t->pclk_mhz = r[22];
+	}
+}
+
+// Data bytes a record moved on the wire.  Timed records carry the count
+// completed, and a failed DATA phase also sent the byte it failed on.  For
+// older records it is only known for transactions that completed.
+static int TraceBytes( const struct TraceRecord * t )
+{
+	if( t->bytes >= 0 ) return ( t->phase == 5 && t->bytes < t->len ) ? t->bytes + 1 : t->bytes;
+	if( t->phase == I2C_TRACE_PHASES ) return t->len;
+	return ( t->phase == 5 ) ? 1 : 0;
+}
+
+// Time from START to the end of the record, and the part of it the bus
+// itself needed, in us.  Returns 0 if the record has no timing.
+static int TraceBusTime( const struct TraceRecord * t, uint32_t ticks_per_us, double * total_us, double * wire_us )
+{
+	double low_ns, high_ns;
+	if( !t->timed || !TraceSCLTiming( t->ckcfgr, t->pclk_mhz, &low_ns, &high_ns ) ) return 0;
+
+	int i;
+	*total_us = 0;
+	*wire_us = 0;
+	for( i = 1; i < I2C_TRACE_PHASES; i++ )
+	{
+		if( !t->ticks[i] ) continue;
+		*total_us += (double)t->ticks[i] / ticks_per_us;
+		*wire_us += TraceWireNs( i, TraceBytes( t ), low_ns, high_ns ) / 1000.0;
+	}
+	if( t->ticks[1] ) *wire_us += high_ns / 1000.0;  // STOP
+	return 1;
+}
+
+// VCD Export.  Edges are generated per record, then sorted by time, since
+// the modelled bus can run past the phase boundaries the target measured.
+struct VcdEvent
+{
+	double t;
+	uint32_t seq;
+	char sig;
+	char val;
+};
+
+struct Vcd
+{
+	struct VcdEvent * ev;
+	uint32_t count, cap;
+	double wire;             // Time the bus is free again, ns
+	double low, high;        // SCL low and high time of the current record
+};
+
+static void VcdPush( struct Vcd * v, double t, char sig, char val )
+{
+	if( v->count == v->cap )
+	{
+		v->cap = v->cap ? v->cap * 2 : 1024;
+		v->ev = realloc( v->ev, v->cap * sizeof( struct VcdEvent ) );
+	}
+	struct VcdEvent * e = &v->ev[v->count];
+	e->t = t;
+	e->seq = v->count++;
+	e->sig = sig;
+	e->val = val;
+}
+
+static double VcdAfterBus( struct Vcd * v, double t )
+{
+	return ( t < v->wire ) ? v->wire : t;
+}
+
+static void VcdStart( struct Vcd * v, double t )
+{
+	t = VcdAfterBus( v, t );
+	VcdPush( v, t, 'd', '0' );
+	VcdPush( v, t + v->high, 'c', '0' );
+	v->wire = t + v->high;
+}
+
+static void VcdRestart( struct Vcd * v, double t )
+{
+	t = VcdAfterBus( v, t );
+	VcdPush( v, t, 'd', '1' );
+	VcdPush( v, t + v->low, 'c', '1' );
+	VcdPush( v, t + v->low + v->high / 2, 'd', '0' );
+	VcdPush( v, t + v->low + v->high, 'c', '0' );
+	v->wire = t + v->low + v->high;
+}
+
+// Eight bits MSB first, then the ACK bit.  A [value] of -1 is unknown data.
+static void VcdByte( struct Vcd * v, double t, int value, char ack )
+{
+	t = VcdAfterBus( v, t );
+	int bit;
+	for( bit = 0; bit < 9; bit++ )
+	{
+		char sda = ack;
+		if( bit < 8 ) sda = ( value < 0 ) ? 'x' : '0' + ( ( value >> ( 7 - bit ) ) & 1 );
+		VcdPush( v, t + v->low / 4, 'd', sda );
+		VcdPush( v, t + v->low, 'c', '1' );
+		VcdPush( v, t + v->low + v->high, 'c', '0' );
+		t += v->low + v->high;
+	}
+	v->wire = t;
+}
+
+static void VcdStop( struct Vcd * v, double t )
+{
+	t = VcdAfterBus( v, t );
+	VcdPush( v, t, 'd', '0' );
+	VcdPush( v, t + v->low, 'c', '1' );
+	VcdPush( v, t + v->low + v->high, 'd', '1' );
+	v->wire = t + v->low + v->high;
+}
+
+// Adds the edges of one record, which ended at [end] ns.
+static void VcdRecord( struct Vcd * v, const struct TraceRecord * t, uint32_t ticks_per_us, double end )
+{
+	double entry[I2C_TRACE_PHASES];
+	double start = end;
+	int i;
+	for( i = I2C_TRACE_PHASES - 1; i >= 0; i-- )
+	{
+		start -= t->ticks[i] * 1000.0 / ticks_per_us;
+		entry[i] = start;
+	}
+
+	int wire = TraceSCLTiming( t->ckcfgr, t->pclk_mhz, &v->low, &v->high );
+	int nack = ( t->err == 2 );
+	for( i = 0; i < I2C_TRACE_PHASES; i++ )
+	{
+		if( !t->ticks[i] ) continue;
+		VcdPush( v, entry[i], 'p', i );
+		if( !wire ) continue;
+
+		char ack = ( nack && t->phase == i ) ? '1' : '0';
+		switch( i )
+		{
+		case 1: VcdStart( v, entry[i] ); break;
+		case 2: VcdByte( v, entry[i], t->addr << 1, ack ); break;
+		case 3: VcdByte( v, entry[i], t->reg, ack ); break;
+		case 4:
+			VcdRestart( v, entry[i] );
+			VcdByte( v, entry[i], ( t->addr << 1 ) | 1, ack );
+			break;
+		case 5:
+		{
+			// Spread the bytes over the phase, as software fed them
+			int n = TraceBytes( t ), b;
+			double span = t->ticks[i] * 1000.0 / ticks_per_us;
+			for( b = 0; b < n; b++ )
+			{
+				char data_ack = t->read ? ( ( b == n - 1 ) ? '1' : '0' ) : ack;
+				VcdByte( v, entry[i] + span * b / n, -1, data_ack );
+			}
+			break;
+		}
+		}
+	}
+
+	if( wire && t->ticks[1] ) VcdStop( v, end );
+	VcdPush( v, VcdAfterBus( v, end ), 'p', I2C_TRACE_PHASES );
+}
+
+static int VcdCompare( const void * a, const void * b )
+{
+	const struct VcdEvent * ea = a, * eb = b;
+	if( ea->t != eb->t ) return ( ea->t < eb->t ) ? -1 : 1;
+	return ( ea->seq < eb->seq ) ? -1 : 1;
+}
+
+static void VcdWrite( struct Vcd * v, FILE * f )
+{
+	fprintf( f, "$comment lib_i2c trace, modelled from CKCFGR $end\n" );
+	fprintf( f, "$timescale 1ns $end\n" );
+	fprintf( f, "$scope module i2c $end\n" );
+	fprintf( f, "$var wire 1 ! scl $end\n" );
+	fprintf( f, "$var wire 1 \" sda $end\n" );
+	fprintf( f, "$var wire 3 # phase $end\n" );
+	fprintf( f, "$upscope $end\n$enddefinitions $end\n" );
+	fprintf( f, "#0\n$dumpvars\n1!\n1\"\nb110 #\n$end\n" );
+
+	qsort( v->ev, v->count, sizeof( struct VcdEvent ), VcdCompare );
+	double base = ( v->count && v->ev[0].t < 0 ) ? v->ev[0].t : 0;
+	long long last = 0;
+	uint32_t i;
+	for( i = 0; i < v->count; i++ )
+	{
+		struct VcdEvent * e = &v->ev[i];
+		long long t = (long long)( e->t - base + 0.5 );
+		if( t > last ) { fprintf( f, "#%lld\n", t ); last = t; }
+		if( e->sig == 'c' ) fprintf( f, "%c!\n", e->val );
+		else if( e->sig == 'd' ) fprintf( f, "%c\"\n", e->val );
+		else fprintf( f, "b%d%d%d #\n", ( e->val >> 2 ) & 1, ( e->val >> 1 ) & 1, e->val & 1 );
+	}
+}
+
+int I2CTraceDump( void * dev, uint32_t address, const char * fname )
+{
+	if( !MCF.ReadBinaryBlob ) return -1;
+
+	// Take a consistent snapshot of the ring, then let the target carry on.
+	uint32_t trace_addr;
+	uint8_t header[I2C_TRACE_HEADER_SIZE];
+	uint8_t * recs = 0;
+	if( MCF.HaltMode ) MCF.HaltMode( dev, HALT_MODE_HALT_BUT_NO_RESET );
+	int r = I2CTraceRead( dev, address, &trace_addr, header, &recs );
+	if( MCF.HaltMode ) MCF.HaltMode( dev, HALT_MODE_RESUME );
+	if( r ) return r;
+
+	uint32_t depth = TraceLE16( header + 4 );
+	uint32_t ticks_per_us = header[6];
+	uint32_t rec_size = TraceRecordSize( header );
+	uint32_t head = TraceLE32( header + 8 );
+	int timed = rec_size >= I2C_TRACE_TIMED16_SIZE;
+
+	FILE * f = 0;
+	int csv = 0, vcd = 0;
+	int namelen = strlen( fname );
+	if( strcmp( fname, "-" ) == 0 )
+		f = stdout;
+	else if( strcmp( fname, "+" ) == 0 )
+		f = stdout, csv = 1;
+	else
+	{
+		csv = namelen > 4 && strcmp( fname + namelen - 4, ".csv" ) == 0;
+		vcd = namelen > 4 && strcmp( fname + namelen - 4, ".vcd" ) == 0;
+		if( vcd && !timed )
+		{
+			fprintf( stderr, "Error: VCD export needs lib_i2c built with I2C_TRACE_TIMING\n" );
+			free( recs );
+			return -9;
+		}
+		f = fopen( fname, "w" );
+	}
+	if( !f )
+	{
+		fprintf( stderr, "Error: can't open write file \"%s\"\n", fname );
+		free( recs );
+		return -9;
+	}
+
+	uint32_t count = ( head < depth ) ? head : depth;
+	uint32_t first = head - count;
+
+	if( csv )
+		fprintf( f, "seq,time_us,delta_us,addr,dir,reg,len,status,phase%s\n",
+			timed ? ",idle_us,start_us,addr_us,reg_us,restart_us,data_us,bus_us,gap_us" : "" );
+	else if( !vcd )
+		fprintf( f, "I2C trace at %08x: %u records (%u total, %u dropped)\n", trace_addr, count, head, head - count );
+
+	// Records are placed back from when they ended, so the first starts before 0
+	struct Vcd v = { 0 };
+	v.wire = -1e30;
+	uint32_t i;
+	uint32_t last_ts = 0;
+	double time_us = 0;
+	for( i = 0; i < count; i++ )
+	{
+		struct TraceRecord t = { 0 };
+		TraceDecode( recs + ( ( first + i ) & ( depth - 1 ) ) * rec_size, rec_size, &t );
+
+		// SysTick is free running, unsigned subtraction handles the wrap.
+		double delta_us = i ? (double)( t.ts - last_ts ) / ticks_per_us : 0;
+		time_us += delta_us;
+		last_ts = t.ts;
+
+		double total_us = 0, wire_us = 0;
+		int bus = TraceBusTime( &t, ticks_per_us, &total_us, &wire_us );
+		double gap_us = ( total_us > wire_us ) ? total_us - wire_us : 0;
+
+		if( vcd )
+		{
+			VcdRecord( &v, &t, ticks_per_us, time_us * 1000.0 );
+		}
+		else if( csv )
+		{
+			fprintf( f, "%u,%.2f,%.2f,0x%02x,%s,0x%02x,%d,%s,%s", first + i, time_us, delta_us,
+				t.addr, t.read ? "R" : "W", t.reg, t.len, TraceError( t.err ), TracePhase( t.phase ) );
+			if( timed )
+			{
+				int p;
+				for( p = 0; p < I2C_TRACE_PHASES; p++ )
+					fprintf( f, ",%.2f", (double)t.ticks[p] / ticks_per_us );
+				if( bus ) fprintf( f, ",%.2f,%.2f", wire_us, gap_us );
+				else fprintf( f, ",," );
+			}
+			fprintf( f, "\n" );
+		}
+		else
+		{
+			fprintf( f, "%6u %12.2fus (+%10.2fus)  %c 0x%02x reg 0x%02x len %3d  %-4s @ %s", first + i, time_us, delta_us,
+				t.read ? 'R' : 'W', t.addr, t.reg, t.len, TraceError( t.err ), TracePhase( t.phase ) );
+			if( bus ) fprintf( f, "  bus %8.2fus gap %8.2fus", wire_us, gap_us );
+			fprintf( f, "\n" );
+		}
+	}
+
+	if( vcd ) VcdWrite( &v, f );
+
+	free( v.ev );
+	free( recs );
+	if( f != stdout ) fclose( f );
+	return 0;
+}
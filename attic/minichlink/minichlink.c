@@ -46,6 +46,8 @@ void * MiniCHLinkInitAsDLL( struct MiniChlinkFunctions ** MCFO, const init_hints
 			dev = TryInit_B003Fun();
 		else if( strcmp( specpgm, "ardulink" ) == 0 )
 			dev = TryInit_B003Fun();
+		else if( strcmp( specpgm, "sim" ) == 0 )
+			dev = TryInit_Sim();
 	}
 	else
 	{
@@ -460,6 +462,65 @@ keep_going:
 						goto unimplemented;
 				break;
 			}
+			case 'l':
+			{
+				if( argchar[2] != 0 )
+				{
+					fprintf( stderr, "Error: can't have char after paramter field\n" ); 
+					goto help;
+				}
+				iarg++;
+				argchar = 0; // Stop advancing
+				if( iarg + 1 >= argc )
+				{
+					fprintf( stderr, "Error: -l requires an output and a trace address.\n" ); 
+					goto help;
+				}
+				const char * fname = argv[iarg++];
+				uint64_t offset = StringToMemoryAddress( argv[iarg] );
+				if( offset > 0xffffffff )
+				{
+					fprintf( stderr, "Error: Invalid offset (%s)\n", argv[iarg] );
+					return -9;
+				}
+				if( !MCF.ReadBinaryBlob )
+					goto unimplemented;
+				if( I2CTraceDump( dev, offset, fname ) )
+				{
+					fprintf( stderr, "Fault reading I2C trace\n" );
+					return -12;
+				}
+				break;
+			}
+			case 'I':
+			{
+				// Takes the rest of the command line, -I2 uses the second bus
+				int bus = 1;
+				if( argchar[2] == '1' || argchar[2] == '2' )
+					bus = argchar[2] - '0';
+				else if( argchar[2] != 0 )
+				{
+					fprintf( stderr, "Error: -I takes a bus number, 1 or 2\n" );
+					goto help;
+				}
+				argchar = 0; // Stop advancing
+				iarg++;
+				if( iarg >= argc )
+				{
+					fprintf( stderr, "Error: -I requires an I2C command.\n" );
+					goto help;
+				}
+				struct InternalState * iss = (struct InternalState*)(((struct ProgrammerStructBase*)dev)->internal);
+				if( !MCF.ReadBinaryBlob || !MCF.WriteBinaryBlob )
+					goto unimplemented;
+				if( I2CBridgeCommand( dev, iss->ram_base, bus, argc - iarg, argv + iarg ) )
+				{
+					fprintf( stderr, "Fault running I2C command\n" );
+					return -12;
+				}
+				iarg = argc;
+				break;
+			}
 			case 'r':
 			{
 				if( MCF.HaltMode ) MCF.HaltMode( dev, HALT_MODE_HALT_BUT_NO_RESET ); //No need to reboot.
@@ -676,7 +737,7 @@ help:
 	fprintf( stderr, " -t Disable 3.3V\n" );
 	fprintf( stderr, " -f Disable 5V\n" );
 	fprintf( stderr, " -c [serial port for Ardulink, try /dev/ttyACM0 or COM11 etc]\n" );
-	fprintf( stderr, " -C [specified programmer, eg. b003boot, ardulink, esp32s2chfun]\n" );
+	fprintf( stderr, " -C [specified programmer, eg. b003boot, ardulink, esp32s2chfun, or sim for a simulated chip]\n" );
 	fprintf( stderr, " -u Clear all code flash - by power off (also can unbrick)\n" );
 	fprintf( stderr, " -E Erase chip\n" );
 	fprintf( stderr, " -b Reboot out of Halt\n" );
@@ -696,6 +757,9 @@ help:
 	fprintf( stderr, " -r [output binary image] [memory address, decimal or 0x, try 0x08000000] [size, decimal or 0x, try 16384]\n" );
 	fprintf( stderr, "   Note: for memory addresses, you can use 'flash' 'launcher' 'bootloader' 'option' 'ram' and say \"ram+0x10\" for instance\n" );
 	fprintf( stderr, "   For filename, you can use - for raw (terminal) or + for hex (inline).\n" );
+	fprintf( stderr, " -l [output, - for text, + for csv, or file(.csv or .vcd)] [lib_i2c trace address, or 'ram' to search]\n" );
+	fprintf( stderr, " -I[bus] [detect | get addr reg [len] | set addr reg byte... | dump addr] runs I2C transfers through a lib_i2c bridge.\n" );
+	fprintf( stderr, "   This MUST be the last argument.\n" );
 	fprintf( stderr, " -T is a terminal. This MUST be the last argument. Also, will start a gdbserver.\n" );
 
 	return -1;	
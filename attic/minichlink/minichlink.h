@@ -183,6 +183,7 @@ void * TryInit_ESP32S2CHFUN(void);
 void * TryInit_NHCLink042(void);
 void * TryInit_B003Fun(void);
 void * TryInit_Ardulink(const init_hints_t*);
+void * TryInit_Sim(void);
 
 // Returns 0 if ok, populated, 1 if not populated.
 int SetupAutomaticHighLevelFunctions( void * dev );
@@ -197,6 +198,18 @@ int InternalIsMemoryErased( struct InternalState * iss, uint32_t address );
 void InternalMarkMemoryNotErased( struct InternalState * iss, uint32_t address );
 int InternalUnlockFlash( void * dev, struct InternalState * iss );
 
+// lib_i2c trace decoder.  Writes pretty text to [fname] ("-" for stdout), CSV
+// if it ends in .csv ("+" for CSV on stdout), or a VCD waveform if it ends in
+// .vcd (needs I2C_TRACE_TIMING).
+int I2CTraceDump( void * dev, uint32_t address, const char * fname );
+
+// Finds a lib_i2c structure by its magic word, at [address] or anywhere in RAM.
+int I2CLocate( void * dev, uint32_t address, uint32_t magic, uint32_t * found );
+
+// lib_i2c bridge (I2C_BRIDGE).  Runs an i2cdetect/get/set/dump style command
+// on the targets bus [bus] (1 or 2), through the mailbox found at [address].
+int I2CBridgeCommand( void * dev, uint32_t address, int bus, int argc, char ** argv );
+
 // GDBSever Functions
 int SetupGDBServer( void * dev );
 int PollGDBServer( void * dev );
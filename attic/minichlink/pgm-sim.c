@@ -0,0 +1,651 @@
+// Simulated programmer, for testing and benchmarking minichlink without a
+// probe or a chip.  Select it with "-C sim", it is never auto-detected.
+//
+// The chip model is a CH32V003: 16kB of flash (also mapped at 0x00000000),
+// the 1920 byte boot area, option bytes, 2kB of RAM and a sparse set of
+// peripheral registers.  Flash behaves like NOR: erasing sets a 64 byte page
+// to 0xff, and programming can only clear bits, so a write skipping the erase
+// shows up as corrupted data just like on a real part.
+//
+// Configuration is through the environment, so CI scripts need no new flags:
+//   MINICHLINK_SIM_FLASH     file the flash is loaded from and saved back to
+//   MINICHLINK_SIM_RAM       file the RAM is loaded from and saved back to
+//   MINICHLINK_SIM_TERMINAL  text the target "prints", read with -T
+//   MINICHLINK_SIM_I2C       lib_i2c bridge devices, eg "0x50,0x68"
+//   MINICHLINK_SIM_LATENCY   per operation delays in us, eg
+//                            "link=300,word=20,erase=2000,program=1500,i2c=25"
+//     link     every call into the programmer (one USB round trip)
+//     word     every 4 bytes moved over the debug link
+//     erase    every 64 byte flash page erased
+//     program  every 64 byte flash page programmed
+//     i2c      every byte a lib_i2c bridge batch moves on the bus
+// Operation counts and the total modelled delay are printed on exit.
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "minichlink.h"
+
+#if defined(WINDOWS) || defined(WIN32) || defined(_WIN32)
+void Sleep(uint32_t dwMilliseconds);
+#define usleep( x ) Sleep( x / 1000 );
+#else
+#include <unistd.h>
+#endif
+
+#define SIM_FLASH_BASE   0x08000000
+#define SIM_FLASH_SIZE   16384
+#define SIM_BOOT_BASE    0x1FFFF000
+#define SIM_BOOT_SIZE    1920
+#define SIM_OPTION_BASE  0x1FFFF800
+#define SIM_OPTION_SIZE  64
+#define SIM_RAM_BASE     0x20000000
+#define SIM_RAM_SIZE     2048
+#define SIM_PAGE_SIZE    64
+#define SIM_PERIPH_REGS  256
+#define SIM_I2C_DEVICES  8
+
+// lib_i2c bridge mailbox, see i2c_bridge_t in lib_i2c.h and i2cbridge.c
+#define SIM_BRIDGE_MAGIC  0x4D433249
+#define SIM_BRIDGE_HEADER 20
+#define SIM_BRIDGE_OP     8
+#define SIM_BRIDGE_OPS    16
+#define SIM_BRIDGE_DATA   256
+
+struct SimLatency
+{
+	int link, word, erase, program, i2c;
+};
+
+struct SimStats
+{
+	uint32_t link_ops, bytes_read, bytes_written, erases, programs, halts, batches;
+	uint64_t modelled_us;
+};
+
+struct SimProgrammerStruct
+{
+	void * internal; // Part of struct ProgrammerStructBase
+
+	uint8_t flash[SIM_FLASH_SIZE];
+	uint8_t boot[SIM_BOOT_SIZE];
+	uint8_t option[SIM_OPTION_SIZE];
+	uint8_t ram[SIM_RAM_SIZE];
+
+	// Peripheral and core registers, any address outside the memories
+	uint32_t periph_addr[SIM_PERIPH_REGS];
+	uint32_t periph_val[SIM_PERIPH_REGS];
+	int periph_count;
+
+	uint32_t dmregs[128];
+	uint32_t cpuregs[32];
+	uint32_t dpc;
+	int halted;
+
+	const char * terminal;
+
+	int i2c_addr[SIM_I2C_DEVICES];
+	uint8_t i2c_regs[SIM_I2C_DEVICES][256];
+	int i2c_count;
+
+	struct SimLatency latency;
+	struct SimStats stats;
+};
+
+static void SimDelay( struct SimProgrammerStruct * sps, uint64_t us )
+{
+	if( !us ) return;
+	sps->stats.modelled_us += us;
+	usleep( us );
+}
+
+// Counts one call into the programmer, moving [bytes] over the link.
+static void SimLink( struct SimProgrammerStruct * sps, uint32_t bytes )
+{
+	sps->stats.link_ops++;
+	SimDelay( sps, sps->latency.link + (uint64_t)sps->latency.word * ( ( bytes + 3 ) / 4 ) );
+}
+
+// Returns the backing memory for [address], and how many bytes follow it.
+static uint8_t * SimMemory( struct SimProgrammerStruct * sps, uint32_t address, uint32_t * avail, int * is_flash )
+{
+	*is_flash = 0;
+	if( address < SIM_FLASH_SIZE ) address += SIM_FLASH_BASE;
+
+	if( address >= SIM_FLASH_BASE && address < SIM_FLASH_BASE + SIM_FLASH_SIZE )
+	{
+		*is_flash = 1;
+		*avail = SIM_FLASH_BASE + SIM_FLASH_SIZE - address;
+		return sps->flash + address - SIM_FLASH_BASE;
+	}
+	if( address >= SIM_BOOT_BASE && address < SIM_BOOT_BASE + SIM_BOOT_SIZE )
+	{
+		*is_flash = 1;
+		*avail = SIM_BOOT_BASE + SIM_BOOT_SIZE - address;
+		return sps->boot + address - SIM_BOOT_BASE;
+	}
+	if( address >= SIM_OPTION_BASE && address < SIM_OPTION_BASE + SIM_OPTION_SIZE )
+	{
+		*is_flash = 1;
+		*avail = SIM_OPTION_BASE + SIM_OPTION_SIZE - address;
+		return sps->option + address - SIM_OPTION_BASE;
+	}
+	if( address >= SIM_RAM_BASE && address < SIM_RAM_BASE + SIM_RAM_SIZE )
+	{
+		*avail = SIM_RAM_BASE + SIM_RAM_SIZE - address;
+		return sps->ram + address - SIM_RAM_BASE;
+	}
+	return 0;
+}
+
+static uint32_t * SimRegister( struct SimProgrammerStruct * sps, uint32_t address )
+{
+	int i;
+	address &= ~3;
+	for( i = 0; i < sps->periph_count; i++ )
+		if( sps->periph_addr[i] == address ) return &sps->periph_val[i];
+	if( sps->periph_count == SIM_PERIPH_REGS ) return 0;
+
+	sps->periph_addr[i] = address;
+	sps->periph_val[i] = 0;
+	sps->periph_count++;
+	return &sps->periph_val[i];
+}
+
+// Byte access to any address.  Unmapped memory reads as 0 and ignores
+// writes, flash writes only clear bits.
+static uint8_t SimRead8( struct SimProgrammerStruct * sps, uint32_t address )
+{
+	uint32_t avail;
+	int is_flash;
+	uint8_t * mem = SimMemory( sps, address, &avail, &is_flash );
+	if( mem ) return *mem;
+
+	uint32_t * reg = SimRegister( sps, address );
+	return reg ? *reg >> ( ( address & 3 ) * 8 ) : 0;
+}
+
+static void SimWrite8( struct SimProgrammerStruct * sps, uint32_t address, uint8_t data )
+{
+	uint32_t avail;
+	int is_flash;
+	uint8_t * mem = SimMemory( sps, address, &avail, &is_flash );
+	if( mem )
+	{
+		if( is_flash ) *mem &= data;
+		else *mem = data;
+		return;
+	}
+
+	uint32_t * reg = SimRegister( sps, address );
+	int shift = ( address & 3 ) * 8;
+	if( reg ) *reg = ( *reg & ~( 0xffu << shift ) ) | ( (uint32_t)data << shift );
+}
+
+static void SimErasePage( struct SimProgrammerStruct * sps, uint32_t address )
+{
+	uint32_t avail;
+	int is_flash;
+	uint8_t * mem = SimMemory( sps, address & ~( SIM_PAGE_SIZE - 1 ), &avail, &is_flash );
+	if( !mem || !is_flash ) return;
+
+	memset( mem, 0xff, ( avail < SIM_PAGE_SIZE ) ? avail : SIM_PAGE_SIZE );
+	sps->stats.erases++;
+	SimDelay( sps, sps->latency.erase );
+}
+
+static void SimLoadFile( const char * fname, uint8_t * mem, int size )
+{
+	FILE * f = fname ? fopen( fname, "rb" ) : 0;
+	if( !f ) return;
+	if( fread( mem, 1, size, f ) == 0 )
+		fprintf( stderr, "Warning: sim could not read \"%s\"\n", fname );
+	fclose( f );
+}
+
+static void SimSaveFile( const char * fname, const uint8_t * mem, int size )
+{
+	FILE * f = fname ? fopen( fname, "wb" ) : 0;
+	if( !f ) return;
+	fwrite( mem, 1, size, f );
+	fclose( f );
+}
+
+static void SimParseLatency( struct SimLatency * lat, const char * spec )
+{
+	char name[16];
+	int value, used;
+	while( spec && sscanf( spec, " %15[a-z]=%d%n", name, &value, &used ) == 2 )
+	{
+		if( strcmp( name, "link" ) == 0 ) lat->link = value;
+		else if( strcmp( name, "word" ) == 0 ) lat->word = value;
+		else if( strcmp( name, "erase" ) == 0 ) lat->erase = value;
+		else if( strcmp( name, "program" ) == 0 ) lat->program = value;
+		else if( strcmp( name, "i2c" ) == 0 ) lat->i2c = value;
+		else fprintf( stderr, "Warning: sim has no latency \"%s\"\n", name );
+
+		spec += used;
+		if( *spec == ',' ) spec++;
+	}
+}
+
+// Runs a pending lib_i2c bridge batch against the simulated I2C devices, as
+// i2c_bridge_poll() would once the core is running again.
+static void SimRunBridge( struct SimProgrammerStruct * sps )
+{
+	uint32_t base;
+	for( base = 0; base + SIM_BRIDGE_HEADER <= SIM_RAM_SIZE; base += 4 )
+	{
+		uint8_t * mb = sps->ram + base;
+		if( ( mb[0] | mb[1]<<8 | mb[2]<<16 | (uint32_t)mb[3]<<24 ) != SIM_BRIDGE_MAGIC ) continue;
+
+		int max_ops = mb[4] | mb[5]<<8;
+		int max_data = mb[6] | mb[7]<<8;
+		int count = mb[16] | mb[17]<<8;
+		if( memcmp( mb + 8, mb + 12, 4 ) == 0 ) return;
+		if( base + SIM_BRIDGE_HEADER + max_ops * SIM_BRIDGE_OP + max_data > SIM_RAM_SIZE ) return;
+		if( count > max_ops ) count = max_ops;
+
+		uint8_t * data = mb + SIM_BRIDGE_HEADER + max_ops * SIM_BRIDGE_OP;
+		int i, bytes = 0;
+		for( i = 0; i < count; i++ )
+		{
+			uint8_t * op = mb + SIM_BRIDGE_HEADER + i * SIM_BRIDGE_OP;
+			int offset = op[6] | op[7]<<8;
+			int len = op[4], dev;
+			for( dev = 0; dev < sps->i2c_count; dev++ )
+				if( sps->i2c_addr[dev] == op[2] ) break;
+
+			bytes += 1 + ( op[0] ? 1 + len : 0 );
+			if( offset + len > max_data ) { op[5] = 4; continue; }        // I2C_ERR_OVR
+			if( op[1] != 0 || dev == sps->i2c_count ) { op[5] = 2; continue; }  // I2C_ERR_NACK
+
+			int b;
+			for( b = 0; b < len; b++ )
+			{
+				if( op[0] == 1 ) data[offset + b] = sps->i2c_regs[dev][( op[3] + b ) & 0xff];
+				if( op[0] == 2 ) sps->i2c_regs[dev][( op[3] + b ) & 0xff] = data[offset + b];
+			}
+			op[5] = 0;
+		}
+
+		memcpy( mb + 12, mb + 8, 4 );
+		sps->stats.batches++;
+		SimDelay( sps, (uint64_t)sps->latency.i2c * bytes );
+		return;
+	}
+}
+
+// With I2C devices configured the simulated firmware is built with
+// I2C_BRIDGE, so give it a mailbox unless the RAM image already holds one.
+static void SimPlaceBridge( struct SimProgrammerStruct * sps )
+{
+	uint32_t base;
+	for( base = 0; base + 4 <= SIM_RAM_SIZE; base += 4 )
+		if( memcmp( sps->ram + base, "I2CM", 4 ) == 0 ) return;
+
+	uint8_t * mb = sps->ram + SIM_RAM_SIZE - SIM_BRIDGE_HEADER - SIM_BRIDGE_OPS * SIM_BRIDGE_OP - SIM_BRIDGE_DATA;
+	memset( mb, 0, SIM_BRIDGE_HEADER );
+	memcpy( mb, "I2CM", 4 );  // SIM_BRIDGE_MAGIC, little endian
+	mb[4] = SIM_BRIDGE_OPS;
+	mb[6] = SIM_BRIDGE_DATA & 0xff; mb[7] = SIM_BRIDGE_DATA >> 8;
+}
+
+static int SimSetupInterface( void * dev )
+{
+	struct InternalState * iss = (struct InternalState*)(((struct ProgrammerStructBase*)dev)->internal);
+	iss->target_chip_type = CHIP_CH32V003;
+	iss->ram_base = SIM_RAM_BASE;
+	iss->ram_size = SIM_RAM_SIZE;
+	iss->sector_size = SIM_PAGE_SIZE;
+	iss->flash_size = SIM_FLASH_SIZE;
+	return 0;
+}
+
+static int SimExit( void * dev )
+{
+	struct SimProgrammerStruct * sps = (struct SimProgrammerStruct *)dev;
+	SimSaveFile( getenv( "MINICHLINK_SIM_FLASH" ), sps->flash, SIM_FLASH_SIZE );
+	SimSaveFile( getenv( "MINICHLINK_SIM_RAM" ), sps->ram, SIM_RAM_SIZE );
+
+	struct SimStats * s = &sps->stats;
+	fprintf( stderr, "sim: %u link ops, %u bytes read, %u written, %u pages erased, %u programmed, %u halts, %u i2c batches, %llu us modelled\n",
+		s->link_ops, s->bytes_read, s->bytes_written, s->erases, s->programs, s->halts, s->batches, (unsigned long long)s->modelled_us );
+	return 0;
+}
+
+static int SimDelayUS( void * dev, int microseconds )
+{
+	usleep( microseconds );
+	return 0;
+}
+
+static int SimFlushLLCommands( void * dev )
+{
+	return 0;
+}
+
+static int SimVoidHighLevelState( void * dev )
+{
+	return 0;
+}
+
+static int SimWaitForDoneOp( void * dev, int ignore )
+{
+	return 0;
+}
+
+static int SimReadBinaryBlob( void * dev, uint32_t address_to_read_from, uint32_t read_size, uint8_t * blob )
+{
+	struct SimProgrammerStruct * sps = (struct SimProgrammerStruct *)dev;
+	uint32_t i;
+	for( i = 0; i < read_size; i++ )
+		blob[i] = SimRead8( sps, address_to_read_from + i );
+	sps->stats.bytes_read += read_size;
+	SimLink( sps, read_size );
+	return 0;
+}
+
+// Flash is written a page at a time, erasing it first, the way the real
+// programmers do.  Other memory is written directly.
+static int SimWriteBinaryBlob( void * dev, uint32_t address_to_write, uint32_t blob_size, uint8_t * blob )
+{
+	struct SimProgrammerStruct * sps = (struct SimProgrammerStruct *)dev;
+	uint32_t pos = 0;
+	while( pos < blob_size )
+	{
+		uint32_t address = address_to_write + pos;
+		uint32_t avail;
+		int is_flash;
+		uint8_t * mem = SimMemory( sps, address, &avail, &is_flash );
+
+		if( !is_flash )
+		{
+			SimWrite8( sps, address, blob[pos++] );
+			continue;
+		}
+
+		uint32_t page = address & ~( SIM_PAGE_SIZE - 1 );
+		uint32_t offset = address - page;
+		uint32_t len = SIM_PAGE_SIZE - offset;
+		if( len > blob_size - pos ) len = blob_size - pos;
+		if( len > avail ) len = avail;
+
+		uint8_t merged[SIM_PAGE_SIZE];
+		uint32_t i;
+		for( i = 0; i < SIM_PAGE_SIZE; i++ )
+			merged[i] = SimRead8( sps, page + i );
+		memcpy( merged + offset, blob + pos, len );
+
+		SimErasePage( sps, page );
+		for( i = 0; i < SIM_PAGE_SIZE; i++ )
+			SimWrite8( sps, page + i, merged[i] );
+		sps->stats.programs++;
+		SimDelay( sps, sps->latency.program );
+
+		(void)mem;
+		pos += len;
+	}
+	sps->stats.bytes_written += blob_size;
+	SimLink( sps, blob_size );
+	return 0;
+}
+
+static int SimBlockWrite64( void * dev, uint32_t address_to_write, uint8_t * data )
+{
+	return SimWriteBinaryBlob( dev, address_to_write, 64, data );
+}
+
+static int SimErase( void * dev, uint32_t address, uint32_t length, int type )
+{
+	struct SimProgrammerStruct * sps = (struct SimProgrammerStruct *)dev;
+	uint32_t page;
+	if( type == 1 )
+	{
+		address = SIM_FLASH_BASE;
+		length = SIM_FLASH_SIZE;
+	}
+	for( page = address & ~( SIM_PAGE_SIZE - 1 ); page < address + length; page += SIM_PAGE_SIZE )
+		SimErasePage( sps, page );
+	SimLink( sps, 0 );
+	return 0;
+}
+
+static int SimWriteWord( void * dev, uint32_t address_to_write, uint32_t data )
+{
+	struct SimProgrammerStruct * sps = (struct SimProgrammerStruct *)dev;
+	int i;
+	for( i = 0; i < 4; i++ )
+		SimWrite8( sps, address_to_write + i, data >> ( i * 8 ) );
+	sps->stats.bytes_written += 4;
+	SimLink( sps, 4 );
+	return 0;
+}
+
+static int SimReadWord( void * dev, uint32_t address_to_read, uint32_t * data )
+{
+	struct SimProgrammerStruct * sps = (struct SimProgrammerStruct *)dev;
+	int i;
+	*data = 0;
+	for( i = 0; i < 4; i++ )
+		*data |= (uint32_t)SimRead8( sps, address_to_read + i ) << ( i * 8 );
+	sps->stats.bytes_read += 4;
+	SimLink( sps, 4 );
+	return 0;
+}
+
+static int SimWriteHalfWord( void * dev, uint32_t address_to_write, uint16_t data )
+{
+	struct SimProgrammerStruct * sps = (struct SimProgrammerStruct *)dev;
+	SimWrite8( sps, address_to_write, data );
+	SimWrite8( sps, address_to_write + 1, data >> 8 );
+	sps->stats.bytes_written += 2;
+	SimLink( sps, 2 );
+	return 0;
+}
+
+static int SimReadHalfWord( void * dev, uint32_t address_to_read, uint16_t * data )
+{
+	struct SimProgrammerStruct * sps = (struct SimProgrammerStruct *)dev;
+	*data = SimRead8( sps, address_to_read ) | ( SimRead8( sps, address_to_read + 1 ) << 8 );
+	sps->stats.bytes_read += 2;
+	SimLink( sps, 2 );
+	return 0;
+}
+
+static int SimWriteByte( void * dev, uint32_t address_to_write, uint8_t data )
+{
+	struct SimProgrammerStruct * sps = (struct SimProgrammerStruct *)dev;
+	SimWrite8( sps, address_to_write, data );
+	sps->stats.bytes_written++;
+	SimLink( sps, 1 );
+	return 0;
+}
+
+static int SimReadByte( void * dev, uint32_t address_to_read, uint8_t * data )
+{
+	struct SimProgrammerStruct * sps = (struct SimProgrammerStruct *)dev;
+	*data = SimRead8( sps, address_to_read );
+	sps->stats.bytes_read++;
+	SimLink( sps, 1 );
+	return 0;
+}
+
+static int SimHaltMode( void * dev, int mode )
+{
+	struct SimProgrammerStruct * sps = (struct SimProgrammerStruct *)dev;
+	SimLink( sps, 0 );
+
+	switch( mode )
+	{
+	case HALT_MODE_HALT_AND_RESET:
+		sps->dpc = SIM_FLASH_BASE;
+		sps->halted = 1;
+		sps->stats.halts++;
+		break;
+	case HALT_MODE_HALT_BUT_NO_RESET:
+		sps->halted = 1;
+		sps->stats.halts++;
+		break;
+	case HALT_MODE_REBOOT:
+	case HALT_MODE_RESUME:
+	case HALT_MODE_GO_TO_BOOTLOADER:
+		if( mode != HALT_MODE_RESUME )
+			sps->dpc = ( mode == HALT_MODE_REBOOT ) ? SIM_FLASH_BASE : SIM_BOOT_BASE;
+		sps->halted = 0;
+		SimRunBridge( sps );
+		break;
+	default:
+		return -1;
+	}
+	return 0;
+}
+
+// Debug Module registers are only stored, except that DMSTATUS reports the
+// halt state and DMCONTROL can halt and resume.
+static int SimWriteReg32( void * dev, uint8_t reg_7_bit, uint32_t command )
+{
+	struct SimProgrammerStruct * sps = (struct SimProgrammerStruct *)dev;
+	sps->dmregs[reg_7_bit & 0x7f] = command;
+	if( reg_7_bit == DMCONTROL && ( command & 0x80000000 ) ) sps->halted = 1;
+	if( reg_7_bit == DMCONTROL && ( command & 0x40000000 ) ) SimHaltMode( dev, HALT_MODE_RESUME );
+	SimLink( sps, 4 );
+	return 0;
+}
+
+static int SimReadReg32( void * dev, uint8_t reg_7_bit, uint32_t * commandresp )
+{
+	struct SimProgrammerStruct * sps = (struct SimProgrammerStruct *)dev;
+	*commandresp = sps->dmregs[reg_7_bit & 0x7f];
+	if( reg_7_bit == DMSTATUS ) *commandresp = sps->halted ? 0x00000382 : 0x00000c82;
+	SimLink( sps, 4 );
+	return 0;
+}
+
+static int SimReadCPURegister( void * dev, uint32_t regno, uint32_t * regret )
+{
+	struct SimProgrammerStruct * sps = (struct SimProgrammerStruct *)dev;
+	if( regno == 0x7b1 ) *regret = sps->dpc;
+	else if( regno >= 0x1000 && regno < 0x1020 ) *regret = sps->cpuregs[regno - 0x1000];
+	else return -1;
+	SimLink( sps, 4 );
+	return 0;
+}
+
+static int SimWriteCPURegister( void * dev, uint32_t regno, uint32_t regval )
+{
+	struct SimProgrammerStruct * sps = (struct SimProgrammerStruct *)dev;
+	if( regno == 0x7b1 ) sps->dpc = regval;
+	else if( regno > 0x1000 && regno < 0x1020 ) sps->cpuregs[regno - 0x1000] = regval;
+	else if( regno != 0x1000 ) return -1;
+	SimLink( sps, 4 );
+	return 0;
+}
+
+static int SimReadAllCPURegisters( void * dev, uint32_t * regret )
+{
+	struct SimProgrammerStruct * sps = (struct SimProgrammerStruct *)dev;
+	memcpy( regret, sps->cpuregs, 16 * sizeof( uint32_t ) );
+	regret[16] = sps->dpc;
+	SimLink( sps, 17 * 4 );
+	return 0;
+}
+
+static int SimWriteAllCPURegisters( void * dev, uint32_t * regret )
+{
+	struct SimProgrammerStruct * sps = (struct SimProgrammerStruct *)dev;
+	memcpy( sps->cpuregs + 1, regret + 1, 15 * sizeof( uint32_t ) );
+	sps->dpc = regret[16];
+	SimLink( sps, 17 * 4 );
+	return 0;
+}
+
+static int SimSetEnableBreakpoints( void * dev, int halt_on_break, int single_step )
+{
+	return 0;
+}
+
+// Hands out MINICHLINK_SIM_TERMINAL a few bytes per poll, as the DMDATA
+// registers would.
+static int SimPollTerminal( void * dev, uint8_t * buffer, int maxlen, uint32_t leaveflagA, int leaveflagB )
+{
+	struct SimProgrammerStruct * sps = (struct SimProgrammerStruct *)dev;
+	SimLink( sps, 8 );
+	if( !sps->terminal || !*sps->terminal ) return 0;
+
+	int len = strlen( sps->terminal );
+	if( len > 7 ) len = 7;
+	if( len > maxlen ) len = maxlen;
+	memcpy( buffer, sps->terminal, len );
+	sps->terminal += len;
+	return len;
+}
+
+static int SimPrintChipInfo( void * dev )
+{
+	printf( "Simulated CH32V003: %d kB flash, %d kB RAM\n", SIM_FLASH_SIZE / 1024, SIM_RAM_SIZE / 1024 );
+	return 0;
+}
+
+void * TryInit_Sim()
+{
+	struct SimProgrammerStruct * sps = calloc( 1, sizeof( struct SimProgrammerStruct ) );
+
+	// A blank part: erased flash, and option bytes holding their defaults
+	memset( sps->flash, 0xff, SIM_FLASH_SIZE );
+	memset( sps->boot, 0xff, SIM_BOOT_SIZE );
+	memset( sps->option, 0xff, SIM_OPTION_SIZE );
+	sps->option[0] = 0xa5; sps->option[1] = 0x5a;
+	*SimRegister( sps, 0x1FFFF7E0 ) = SIM_FLASH_SIZE / 1024;  // ESIG Flash Size
+	sps->halted = 1;
+
+	SimLoadFile( getenv( "MINICHLINK_SIM_FLASH" ), sps->flash, SIM_FLASH_SIZE );
+	SimLoadFile( getenv( "MINICHLINK_SIM_RAM" ), sps->ram, SIM_RAM_SIZE );
+	SimParseLatency( &sps->latency, getenv( "MINICHLINK_SIM_LATENCY" ) );
+	sps->terminal = getenv( "MINICHLINK_SIM_TERMINAL" );
+
+	const char * devices = getenv( "MINICHLINK_SIM_I2C" );
+	while( devices && *devices && sps->i2c_count < SIM_I2C_DEVICES )
+	{
+		char * end;
+		sps->i2c_addr[sps->i2c_count++] = strtol( devices, &end, 0 ) & 0x7f;
+		if( end == devices ) break;
+		devices = ( *end == ',' ) ? end + 1 : end;
+	}
+	if( sps->i2c_count ) SimPlaceBridge( sps );
+
+	memset( &MCF, 0, sizeof( MCF ) );
+	MCF.WriteReg32 = SimWriteReg32;
+	MCF.ReadReg32 = SimReadReg32;
+	MCF.FlushLLCommands = SimFlushLLCommands;
+	MCF.DelayUS = SimDelayUS;
+	MCF.SetupInterface = SimSetupInterface;
+	MCF.Exit = SimExit;
+	MCF.HaltMode = SimHaltMode;
+	MCF.VoidHighLevelState = SimVoidHighLevelState;
+	MCF.PollTerminal = SimPollTerminal;
+	MCF.PrintChipInfo = SimPrintChipInfo;
+
+	MCF.WriteBinaryBlob = SimWriteBinaryBlob;
+	MCF.ReadBinaryBlob = SimReadBinaryBlob;
+	MCF.Erase = SimErase;
+	MCF.BlockWrite64 = SimBlockWrite64;
+	MCF.WaitForDoneOp = SimWaitForDoneOp;
+	MCF.WaitForFlash = SimFlushLLCommands;
+
+	MCF.WriteWord = SimWriteWord;
+	MCF.ReadWord = SimReadWord;
+	MCF.WriteHalfWord = SimWriteHalfWord;
+	MCF.ReadHalfWord = SimReadHalfWord;
+	MCF.WriteByte = SimWriteByte;
+	MCF.ReadByte = SimReadByte;
+
+	MCF.ReadCPURegister = SimReadCPURegister;
+	MCF.WriteCPURegister = SimWriteCPURegister;
+	MCF.ReadAllCPURegisters = SimReadAllCPURegisters;
+	MCF.WriteAllCPURegisters = SimWriteAllCPURegisters;
+	MCF.SetEnableBreakpoints = SimSetEnableBreakpoints;
+
+	return sps;
+}
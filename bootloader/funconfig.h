@@ -0,0 +1,9 @@
+#ifndef _FUNCONFIG_H
+#define _FUNCONFIG_H
+
+#define CH32V003                 1
+#define FUNCONF_TINYVECTOR       1
+#define FUNCONF_USE_DEBUGPRINTF  0
+#define FUNCONF_SYSTICK_USE_HCLK 0
+
+#endif
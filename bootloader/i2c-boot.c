@@ -0,0 +1,236 @@
+/******************************************************************************
+* I2C EEPROM Bootloader for the CH32V003, using lib_i2c
+*
+* Runs from the 1920 byte Boot Area. At reset it checks an I2C EEPROM or FRAM
+* for an application image. If the image is valid and differs from the one in
+* flash, it is copied into flash, then the application is started. With no
+* memory fitted, or a bad image, the application starts as normal - so a
+* fleet can be updated by plugging in a memory module and resetting.
+*
+* Blocks are read with polled lib_i2c loads, one at a time, to fit the Boot
+* Area. Reading the next block while programming the current one needs DMA
+* and a second buffer, which would not fit.
+*
+* The last flash page holds an Install Record, a copy of the Image Header. It
+* is erased before an update and only written once the whole application is
+* in flash and matches the CRC. At reset the application is only started if
+* the record is there and the flash matches its CRC - so an update that was
+* cut short is never started, whatever erased flash reads back as. The
+* bootloader stays in control and retries instead. Applications must leave
+* the last page free, and one flashed without the bootloader has no record,
+* so it only starts once it has been installed from a memory.
+*
+* Image layout in the memory, starting at address 0x0000:
+*   0x00  uint32_t magic, I2C_BOOT_MAGIC ("I2CB")
+*   0x04  uint16_t length of the application in bytes
+*   0x06  uint16_t CRC-16/CCITT-FALSE of the application, see i2c_crc16()
+*         (Python: binascii.crc_hqx(app, 0xFFFF))
+*   0x40  The application .bin, copied to the start of flash
+* All values are little endian.
+*
+* See GitHub Repo for more information:
+* https://github.com/ADBeta/CH32V000x-lib_i2c
+*
+* Released under the MIT Licence
+* Copyright ADBeta (c) 2024
+******************************************************************************/
+#include "ch32v003fun.h"
+#include "lib_i2c.h"
+
+// Memory holding the image. 24C32 and larger use 2 Address Bytes
+#define I2C_BOOT_ADDR       0x50
+#define I2C_BOOT_ADDR_BYTES 2
+#define I2C_BOOT_CLK        I2C_CLK_400KHZ
+
+#define I2C_BOOT_MAGIC      0x42433249
+#define I2C_BOOT_HEADER     0x40
+#define I2C_BOOT_BLOCK      64
+#define I2C_BOOT_ATTEMPTS   3
+
+// Install Record, in the last page of the 16KB flash. The application can use
+// everything below it
+#define I2C_BOOT_RECORD     (FLASH_BASE + 0x3FC0)
+#define I2C_BOOT_MAX_LEN    0x3FC0
+
+// Image Header, the first 8 bytes at address 0 of the memory. Also the layout
+// of the Install Record
+typedef struct {
+	uint32_t magic;
+	uint16_t length;
+	uint16_t crc;
+} i2c_boot_header_t;
+
+// One flash page worth of the image
+static uint8_t block[I2C_BOOT_BLOCK] __attribute__((aligned(4)));
+
+
+/// @brief Unlocks the Flash Controller, including Fast Page Programming
+/// @param None
+/// @return None
+static void flash_unlock(void)
+{
+	FLASH->KEYR     = FLASH_KEY1;
+	FLASH->KEYR     = FLASH_KEY2;
+	FLASH->MODEKEYR = FLASH_KEY1;
+	FLASH->MODEKEYR = FLASH_KEY2;
+}
+
+/// @brief Erases one 64 byte flash page
+/// @param addr, Page address, 64 byte aligned
+/// @return None
+static void flash_erase(const uint32_t addr)
+{
+	FLASH->CTLR = CR_PAGE_ER;
+	FLASH->ADDR = addr;
+	FLASH->CTLR = CR_PAGE_ER | CR_STRT_Set;
+	while(FLASH->STATR & FLASH_STATR_BSY);
+	FLASH->CTLR = 0;
+}
+
+/// @brief Erases and programs one 64 byte flash page
+/// @param addr, Page address, 64 byte aligned
+/// @param data, 64 bytes to program, word aligned
+/// @return None
+static void flash_page(const uint32_t addr, const uint8_t *data)
+{
+	flash_erase(addr);
+
+	// Fill the page buffer one word at a time, then program it
+	FLASH->CTLR = CR_PAGE_PG;
+	FLASH->CTLR = CR_PAGE_PG | CR_BUF_RST;
+	FLASH->ADDR = addr;
+	while(FLASH->STATR & FLASH_STATR_BSY);
+	for(uint8_t word = 0; word < I2C_BOOT_BLOCK / 4; word++)
+	{
+		((volatile uint32_t *)addr)[word] = ((const uint32_t *)data)[word];
+		FLASH->CTLR = CR_PAGE_PG | CR_BUF_LOAD;
+		while(FLASH->STATR & FLASH_STATR_BSY);
+	}
+	FLASH->CTLR = CR_PAGE_PG | CR_STRT_Set;
+	while(FLASH->STATR & FLASH_STATR_BSY);
+
+	FLASH->CTLR = 0;
+}
+
+/// @brief Leaves the bootloader, resetting into the application in flash
+/// @param None
+/// @return None
+static void boot_application(void)
+{
+	FLASH->BOOT_MODEKEYR = FLASH_KEY1;
+	FLASH->BOOT_MODEKEYR = FLASH_KEY2;
+	FLASH->STATR = 0;               // Boot from user flash next time
+	FLASH->CTLR  = CR_LOCK_Set;
+	PFIC->SCTLR  = 1 << 31;         // System Reset
+	while(1);
+}
+
+/// @brief Stays in the bootloader, the application is incomplete. Resets
+/// back into the Boot Area after a second, to try the memory again
+/// @param None
+/// @return None
+__attribute__((noinline))
+static void boot_retry(void)
+{
+	Delay_Ms(1000);
+	PFIC->SCTLR = 1 << 31;          // System Reset, Boot Mode is unchanged
+	while(1);
+}
+
+/// @brief Starts the application if it is installed, otherwise stays in the
+/// bootloader
+/// @param app_ok, 1 if the Install Record matches the flash
+/// @return None
+static void boot_fallback(const uint8_t app_ok)
+{
+	if(app_ok) boot_application();
+	boot_retry();
+}
+
+/// @brief Checks the application in flash against an Image Header
+/// @param header, Image Header, or the Install Record
+/// @return uint8_t, 1 if the flash holds the image
+static uint8_t app_matches(const i2c_boot_header_t *header)
+{
+	return header->magic == I2C_BOOT_MAGIC && header->length <= I2C_BOOT_MAX_LEN &&
+	       i2c_crc16(I2C_CRC16_INIT, (const uint8_t *)FLASH_BASE,
+	                 header->length) == header->crc;
+}
+
+/// @brief Reads from the memory, using a polled lib_i2c load
+/// @param mem_addr, Memory Address to read from
+/// @param buf, Buffer to read into
+/// @param len, Bytes to read
+/// @return i2c_err_t, I2C_OK if the bytes were read
+static i2c_err_t image_read(const uint16_t mem_addr, uint8_t *buf, const uint16_t len)
+{
+	i2c_load_t load = {.addr_bytes = I2C_BOOT_ADDR_BYTES};
+	return i2c_load(I2C_BOOT_ADDR, mem_addr, buf, len, &load);
+}
+
+/// @brief Reads the whole image from the memory, checking its CRC, or
+/// programming it into flash. A short final block is padded with 0xFF
+/// @param header, Image Header
+/// @param program, 1 to program each block into flash
+/// @return i2c_err_t, I2C_OK if every block was read and the CRC matches
+static i2c_err_t image_pass(const i2c_boot_header_t *header, const uint8_t program)
+{
+	const uint16_t len = header->length;
+	uint16_t crc = I2C_CRC16_INIT;
+	for(uint16_t offset = 0; offset < len; offset += I2C_BOOT_BLOCK)
+	{
+		const uint16_t chunk = (len - offset < I2C_BOOT_BLOCK) ? len - offset : I2C_BOOT_BLOCK;
+		for(uint8_t pad = chunk; pad < I2C_BOOT_BLOCK; pad++) block[pad] = 0xFF;
+
+		const i2c_err_t i2c_ret = image_read(I2C_BOOT_HEADER + offset, block, chunk);
+		if(i2c_ret != I2C_OK) return i2c_ret;
+
+		crc = i2c_crc16(crc, block, chunk);
+		if(program) flash_page(FLASH_BASE + offset, block);
+	}
+	return (crc == header->crc) ? I2C_OK : I2C_ERR_VERIFY;
+}
+
+
+int main()
+{
+	SystemInit();
+
+	i2c_boot_header_t header;
+
+	// Only a fully written application has an Install Record that matches it
+	const i2c_boot_header_t *record = (const i2c_boot_header_t *)I2C_BOOT_RECORD;
+	const uint8_t app_ok = app_matches(record);
+
+	// No memory, or no image - start the application as it is
+	if(i2c_init(I2C_BOOT_CLK) != I2C_OK ||
+	   image_read(0x0000, (uint8_t *)&header, sizeof(header)) != I2C_OK ||
+	   header.magic != I2C_BOOT_MAGIC || header.length == 0 ||
+	   header.length > I2C_BOOT_MAX_LEN)
+		boot_fallback(app_ok);
+
+	// Already installed
+	if(app_ok && record->length == header.length && record->crc == header.crc)
+		boot_application();
+
+	// Never erase a working application for a corrupt image
+	if(image_pass(&header, 0) != I2C_OK) boot_fallback(app_ok);
+
+	// Remove the Install Record, copy the image, then check what landed in
+	// flash against the CRC before writing the record back. Retry on a failure
+	flash_unlock();
+	for(uint8_t attempt = 0; attempt < I2C_BOOT_ATTEMPTS; attempt++)
+	{
+		flash_erase(I2C_BOOT_RECORD);
+		if(image_pass(&header, 1) != I2C_OK || !app_matches(&header)) continue;
+
+		for(uint8_t pad = 0; pad < I2C_BOOT_BLOCK; pad++) block[pad] = 0xFF;
+		*(i2c_boot_header_t *)block = header;
+		flash_page(I2C_BOOT_RECORD, block);
+
+		if(app_matches(record)) boot_application();
+	}
+
+	// The application was not fully written, stay in the bootloader
+	boot_retry();
+}
@@ -0,0 +1,270 @@
+/******************************************************************************
+* DS3231 Real Time Clock Driver, built on lib_i2c. See ds3231.h
+*
+* See GitHub Repo for more information:
+* https://github.com/ADBeta/CH32V000x-lib_i2c
+*
+* Released under the MIT Licence
+* Copyright ADBeta (c) 2024
+******************************************************************************/
+#include "ds3231.h"
+#include <stddef.h>
+
+// SysTick Counts per second, the same clock lib_i2c uses
+#define DS3231_TICKS_PER_SEC (DELAY_MS_TIME * 1000)
+
+#if defined(CH32V10x) || defined(CH32X03x)
+	#define DS3231_TIMESTAMP() (SysTick->CNTL)
+#else
+	#define DS3231_TIMESTAMP() ((uint32_t)SysTick->CNT)
+#endif
+
+/*** Static Functions ********************************************************/
+static inline uint8_t ds3231_from_bcd(const uint8_t bcd)
+{
+	return (bcd >> 4) * 10 + (bcd & 0x0F);
+}
+
+static inline uint8_t ds3231_to_bcd(const uint8_t val)
+{
+	return ((val / 10) << 4) | (val % 10);
+}
+
+/// @brief Gets the number of days in a month
+/// @param month, 1 - 12
+/// @param year, 2000 - 2099, every 4th year is a leap year in this range
+/// @return uint8_t days
+static uint8_t ds3231_month_days(const uint8_t month, const uint16_t year)
+{
+	static const uint8_t days[12] = {31,28,31,30,31,30,31,31,30,31,30,31};
+	if(month == 2 && (year & 0x03) == 0) return 29;
+	return days[month - 1];
+}
+
+/// @brief Advances a time by a number of seconds, carrying into the date
+/// @param time, Time to advance
+/// @param secs, Seconds to add
+/// @return None
+static void ds3231_advance(ds3231_time_t *time, uint32_t secs)
+{
+	secs += time->sec;
+	time->sec = secs % 60;
+	uint32_t mins = time->min + secs / 60;
+	time->min = mins % 60;
+	uint32_t hours = time->hour + mins / 60;
+	time->hour = hours % 24;
+
+	for(uint32_t days = hours / 24; days > 0; days--)
+	{
+		time->day = (time->day % 7) + 1;
+		if(++time->date > ds3231_month_days(time->month, time->year))
+		{
+			time->date = 1;
+			if(++time->month > 12) { time->month = 1; time->year++; }
+		}
+	}
+}
+
+/// @brief Decodes the 7 Time Registers, 24 hour or 12 hour AM/PM mode
+/// @param raw, Registers 0x00 - 0x06
+/// @param time, Decoded time
+/// @return None
+static void ds3231_decode(const uint8_t *raw, ds3231_time_t *time)
+{
+	time->sec   = ds3231_from_bcd(raw[0] & 0x7F);
+	time->min   = ds3231_from_bcd(raw[1] & 0x7F);
+
+	// Bit 6 selects 12 hour mode, where bit 5 is PM
+	if(raw[2] & 0x40)
+		time->hour = ds3231_from_bcd(raw[2] & 0x1F) % 12 + ((raw[2] & 0x20) ? 12 : 0);
+	else
+		time->hour = ds3231_from_bcd(raw[2] & 0x3F);
+
+	time->day   = raw[3] & 0x07;
+	time->date  = ds3231_from_bcd(raw[4] & 0x3F);
+	time->month = ds3231_from_bcd(raw[5] & 0x1F);
+	time->year  = 2000 + ds3231_from_bcd(raw[6]);
+}
+
+/// @brief Clears flags in the Status Register, keeping the others
+/// @param rtc, Driver Handle
+/// @param flags, DS3231_STATUS_* bits to clear
+/// @return i2c_err_t, I2C_OK on success
+static i2c_err_t ds3231_clear_status(ds3231_t *rtc, const uint8_t flags)
+{
+	uint8_t status;
+	i2c_err_t i2c_ret = i2c_dev_read(&rtc->dev, DS3231_REG_STATUS, &status, 1);
+	if(i2c_ret != I2C_OK) return i2c_ret;
+
+	status &= ~flags;
+	return i2c_dev_write(&rtc->dev, DS3231_REG_STATUS, &status, 1);
+}
+
+
+/*** API Functions ***********************************************************/
+i2c_err_t ds3231_init(ds3231_t *rtc, i2c_bus_t *bus)
+{
+	i2c_device_init(&rtc->dev, bus, DS3231_ADDR, I2C_CLK_400KHZ);
+	rtc->alarm = 0;
+
+	// Alarm Interrupt on INT/SQW, no square wave. Clear old alarm flags
+	// but keep OSF, so an invalid time can still be spotted
+	const uint8_t ctrl = DS3231_CONTROL_INTCN;
+	i2c_err_t i2c_ret = i2c_dev_write(&rtc->dev, DS3231_REG_CONTROL, &ctrl, 1);
+	if(i2c_ret != I2C_OK) return i2c_ret;
+
+	i2c_ret = ds3231_clear_status(rtc, DS3231_STATUS_A1F | DS3231_STATUS_A2F);
+	if(i2c_ret != I2C_OK) return i2c_ret;
+
+	return ds3231_read(rtc, NULL);
+}
+
+
+i2c_err_t ds3231_read(ds3231_t *rtc, ds3231_time_t *time)
+{
+	uint8_t raw[7];
+	i2c_err_t i2c_ret = i2c_dev_read(&rtc->dev, DS3231_REG_TIME, raw, 7);
+	if(i2c_ret != I2C_OK) return i2c_ret;
+
+	// The chip counts from the moment the burst was latched
+	rtc->tick = DS3231_TIMESTAMP();
+	rtc->since_sync = 0;
+	ds3231_decode(raw, &rtc->time);
+
+	if(time != NULL) *time = rtc->time;
+	return I2C_OK;
+}
+
+
+i2c_err_t ds3231_write(ds3231_t *rtc, const ds3231_time_t *time)
+{
+	const uint8_t raw[7] = {
+		ds3231_to_bcd(time->sec),  ds3231_to_bcd(time->min),
+		ds3231_to_bcd(time->hour), time->day,
+		ds3231_to_bcd(time->date), ds3231_to_bcd(time->month),
+		ds3231_to_bcd(time->year - 2000),
+	};
+
+	i2c_err_t i2c_ret = i2c_dev_write(&rtc->dev, DS3231_REG_TIME, raw, 7);
+	if(i2c_ret != I2C_OK) return i2c_ret;
+
+	rtc->tick = DS3231_TIMESTAMP();
+	rtc->since_sync = 0;
+	rtc->time = *time;
+
+	// The time is valid now, clear Oscillator Stopped
+	return ds3231_clear_status(rtc, DS3231_STATUS_OSF);
+}
+
+
+i2c_err_t ds3231_now(ds3231_t *rtc, ds3231_time_t *time)
+{
+	// Move the cache on by whole seconds, keeping the remainder in [tick]
+	const uint32_t secs = (DS3231_TIMESTAMP() - rtc->tick) / DS3231_TICKS_PER_SEC;
+	if(secs > 0)
+	{
+		rtc->tick += secs * DS3231_TICKS_PER_SEC;
+		rtc->since_sync += secs;
+		ds3231_advance(&rtc->time, secs);
+	}
+
+	// Correct the drift from the crystal now and then
+	if(rtc->since_sync >= DS3231_SYNC_SEC) return ds3231_read(rtc, time);
+
+	*time = rtc->time;
+	return I2C_OK;
+}
+
+
+i2c_err_t ds3231_set_alarm(ds3231_t *rtc, const ds3231_alarm_t mode,
+                           const uint8_t hour, const uint8_t min,
+                           const uint8_t sec)
+{
+	// Bit 7 of each Alarm Register masks it out of the match. The day/date
+	// register is always masked
+	const uint8_t raw[4] = {
+		ds3231_to_bcd(sec)  | ((mode & 0x01) << 7),
+		ds3231_to_bcd(min)  | ((mode & 0x02) << 6),
+		ds3231_to_bcd(hour) | ((mode & 0x04) << 5),
+		0x80,
+	};
+
+	i2c_err_t i2c_ret = i2c_dev_write(&rtc->dev, DS3231_REG_ALARM1, raw, 4);
+	if(i2c_ret != I2C_OK) return i2c_ret;
+
+	// Clear any stale match, then let Alarm 1 drive INT/SQW
+	i2c_ret = ds3231_clear_status(rtc, DS3231_STATUS_A1F);
+	if(i2c_ret != I2C_OK) return i2c_ret;
+
+	rtc->alarm = 0;
+	const uint8_t ctrl = DS3231_CONTROL_INTCN | DS3231_CONTROL_A1IE;
+	return i2c_dev_write(&rtc->dev, DS3231_REG_CONTROL, &ctrl, 1);
+}
+
+
+void ds3231_alarm_exti(ds3231_t *rtc, GPIO_TypeDef *port, const uint8_t pin)
+{
+	rtc->exti_line = pin;
+
+	// INT/SQW is open drain, use the internal Pull-Up
+	RCC->APB2PCENR |= RCC_APB2Periph_AFIO;
+	volatile uint32_t *cfgr = (pin < 8) ? &port->CFGLR : &port->CFGHR;
+	const uint32_t shift = 4 * (pin & 0x07);
+	*cfgr = (*cfgr & ~(0x0F << shift)) | (GPIO_CNF_IN_PUPD << shift);
+	port->BSHR = 1 << pin;
+
+	// Route the pin to its EXTI line, the port index is its offset from GPIOA
+	const uint32_t port_idx = ((uint32_t)port - GPIOA_BASE) / 0x400;
+	#if defined(CH32V003)
+	AFIO->EXTICR = (AFIO->EXTICR & ~(0x03 << (2 * pin))) | (port_idx << (2 * pin));
+	#else
+	const uint32_t ext_shift = 4 * (pin & 0x03);
+	AFIO->EXTICR[pin >> 2] = (AFIO->EXTICR[pin >> 2] & ~(0x0F << ext_shift))
+	                         | (port_idx << ext_shift);
+	#endif
+
+	EXTI->FTENR  |= 1 << pin;
+	EXTI->INTENR |= 1 << pin;
+
+	#if defined(CH32V003)
+	NVIC_EnableIRQ(EXTI7_0_IRQn);
+	#endif
+}
+
+
+void ds3231_alarm_isr(ds3231_t *rtc)
+{
+	if(EXTI->INTFR & (1 << rtc->exti_line))
+	{
+		EXTI->INTFR = 1 << rtc->exti_line;
+		rtc->alarm = 1;
+	}
+}
+
+
+uint8_t ds3231_alarm_pending(ds3231_t *rtc)
+{
+	if(!rtc->alarm) return 0;
+	rtc->alarm = 0;
+
+	// Clear A1F, which releases INT/SQW for the next alarm
+	ds3231_clear_status(rtc, DS3231_STATUS_A1F);
+	return 1;
+}
+
+
+void ds3231_sleep(ds3231_t *rtc)
+{
+	// The flag is checked with interrupts off, so an alarm between the
+	// check and the WFI still wakes it
+	__disable_irq();
+	while(!rtc->alarm)
+	{
+		__WFI();
+		__enable_irq();
+		__disable_irq();
+	}
+	__enable_irq();
+
+	ds3231_alarm_pending(rtc);
+}
@@ -0,0 +1,154 @@
+/******************************************************************************
+* DS3231 Real Time Clock Driver, built on lib_i2c
+*
+* The time and date are read in one 7 byte burst and decoded from BCD. The
+* result is cached and advanced locally from SysTick, so reading the time does
+* not use the bus - the chip is only re-read every DS3231_SYNC_SEC seconds.
+* Alarm 1 drives the INT/SQW pin, which can wake the MCU through an EXTI line
+* instead of polling the chip.
+*
+* Example:
+*   ds3231_t rtc;
+*   ds3231_init(&rtc, &i2c_bus1);
+*   ds3231_alarm_exti(&rtc, GPIOD, 2);              // INT/SQW on PD2
+*   ds3231_set_alarm(&rtc, DS3231_ALARM_SEC, 0, 0, 0);  // Every minute, at :00
+*
+*   void EXTI7_0_IRQHandler(void) __attribute__((interrupt));
+*   void EXTI7_0_IRQHandler(void) { ds3231_alarm_isr(&rtc); }
+*
+*   while(1) {
+*       ds3231_sleep(&rtc);       // Sleeps until the alarm
+*       ds3231_now(&rtc, &time);  // No bus traffic
+*   }
+*
+* See GitHub Repo for more information:
+* https://github.com/ADBeta/CH32V000x-lib_i2c
+*
+* Released under the MIT Licence
+* Copyright ADBeta (c) 2024
+******************************************************************************/
+#ifndef CH32_DS3231_H
+#define CH32_DS3231_H
+
+#include "lib_i2c.h"
+
+/*** Hardware Definitions ****************************************************/
+#define DS3231_ADDR 0x68
+
+// Registers
+#define DS3231_REG_TIME    0x00  // 7 bytes: sec, min, hour, day, date, month, year
+#define DS3231_REG_ALARM1  0x07  // 4 bytes: sec, min, hour, day/date
+#define DS3231_REG_CONTROL 0x0E
+#define DS3231_REG_STATUS  0x0F
+
+// Control and Status bits
+#define DS3231_CONTROL_A1IE  0x01  // Alarm 1 drives INT/SQW
+#define DS3231_CONTROL_INTCN 0x04  // INT/SQW is the alarm interrupt, not a square wave
+#define DS3231_STATUS_A1F    0x01  // Alarm 1 matched
+#define DS3231_STATUS_A2F    0x02  // Alarm 2 matched
+#define DS3231_STATUS_OSF    0x80  // Oscillator stopped, the time is not valid
+
+// Seconds between re-reads of the chip. SysTick drifts against the crystal,
+// and can only be followed for one SysTick wrap (~89s at 48MHz HCLK, ~715s
+// at HCLK/8), so ds3231_now() must be called at least that often
+#ifndef DS3231_SYNC_SEC
+#define DS3231_SYNC_SEC 60
+#endif
+
+/*** Types *******************************************************************/
+// Time and Date, decoded from BCD
+typedef struct {
+	uint8_t  sec;     // 0 - 59
+	uint8_t  min;     // 0 - 59
+	uint8_t  hour;    // 0 - 23
+	uint8_t  day;     // Day of the Week, 1 - 7
+	uint8_t  date;    // Day of the Month, 1 - 31
+	uint8_t  month;   // 1 - 12
+	uint16_t year;    // 2000 - 2099
+} ds3231_time_t;
+
+// Alarm 1 match modes
+typedef enum {
+	DS3231_ALARM_EVERY_SEC = 0x0F,  // Once per second
+	DS3231_ALARM_SEC       = 0x0E,  // When the seconds match
+	DS3231_ALARM_MIN_SEC   = 0x0C,  // When the minutes and seconds match
+	DS3231_ALARM_HOUR      = 0x08,  // When the hours, minutes and seconds match
+} ds3231_alarm_t;
+
+// Driver Handle
+typedef struct {
+	i2c_device_t dev;
+	ds3231_time_t time;      // Cached time, at [tick]
+	uint32_t tick;           // SysTick count the cached time is for
+	uint16_t since_sync;     // Seconds advanced locally since the last read
+	volatile uint8_t alarm;  // Set by ds3231_alarm_isr()
+	uint8_t  exti_line;      // EXTI line INT/SQW is on
+} ds3231_t;
+
+/*** Functions ***************************************************************/
+/// @brief Initialises the driver and the chip. INT/SQW is set up as the
+/// alarm interrupt output, and any old alarm flags are cleared
+/// @param rtc, Driver Handle
+/// @param bus, Bus the DS3231 is on, already initialised
+/// @return i2c_err_t, I2C_OK on success
+i2c_err_t ds3231_init(ds3231_t *rtc, i2c_bus_t *bus);
+
+/// @brief Reads the time from the chip in one 7 byte burst, and refreshes
+/// the cached time
+/// @param rtc, Driver Handle
+/// @param time, where to store the time, may be NULL
+/// @return i2c_err_t, I2C_OK on success
+i2c_err_t ds3231_read(ds3231_t *rtc, ds3231_time_t *time);
+
+/// @brief Sets the time on the chip, and the cached time. Clears the
+/// Oscillator Stopped flag
+/// @param rtc, Driver Handle
+/// @param time, Time to set
+/// @return i2c_err_t, I2C_OK on success
+i2c_err_t ds3231_write(ds3231_t *rtc, const ds3231_time_t *time);
+
+/// @brief Gets the current time. The cached time is advanced by the whole
+/// seconds SysTick has counted, and only re-read from the chip every
+/// DS3231_SYNC_SEC seconds
+/// @param rtc, Driver Handle
+/// @param time, where to store the time
+/// @return i2c_err_t, I2C_OK on success, or the error of the re-read
+i2c_err_t ds3231_now(ds3231_t *rtc, ds3231_time_t *time);
+
+/// @brief Sets Alarm 1 and enables it on INT/SQW
+/// @param rtc, Driver Handle
+/// @param mode, which fields must match
+/// @param hour, min, sec to match
+/// @return i2c_err_t, I2C_OK on success
+i2c_err_t ds3231_set_alarm(ds3231_t *rtc, const ds3231_alarm_t mode,
+                           const uint8_t hour, const uint8_t min,
+                           const uint8_t sec);
+
+/// @brief Sets up a GPIO Pin wired to INT/SQW as a falling edge EXTI line.
+/// On the CH32V003 the EXTI7_0 interrupt is enabled too, other parts must
+/// enable the EXTI interrupt for the pin. The application defines the
+/// handler, and calls ds3231_alarm_isr() from it
+/// @param rtc, Driver Handle
+/// @param port, GPIO Port, eg GPIOD
+/// @param pin, Pin number 0 - 15
+/// @return None
+void ds3231_alarm_exti(ds3231_t *rtc, GPIO_TypeDef *port, const uint8_t pin);
+
+/// @brief Call from the EXTI Interrupt Handler. Marks the alarm as pending
+/// @param rtc, Driver Handle
+/// @return None
+void ds3231_alarm_isr(ds3231_t *rtc);
+
+/// @brief Checks for a pending alarm, and clears it on the chip so INT/SQW
+/// is released
+/// @param rtc, Driver Handle
+/// @return uint8_t, 1 if the alarm fired since the last call
+uint8_t ds3231_alarm_pending(ds3231_t *rtc);
+
+/// @brief Sleeps (WFI) until the alarm fires, then clears it. SysTick keeps
+/// running in Sleep, so the cached time stays correct
+/// @param rtc, Driver Handle
+/// @return None
+void ds3231_sleep(ds3231_t *rtc);
+
+#endif
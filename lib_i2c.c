@@ -30,273 +30,2512 @@
 * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE 
 * USE OR OTHER DEALINGS IN THE SOFTWARE.
 ******************************************************************************/
+#ifndef CH32_LIB_I2C_C
+#define CH32_LIB_I2C_C
+
 #include "lib_i2c.h"
 #include <stddef.h>
 
+#ifdef I2C_DMA
+	#include "ch32v003_DMA.h"
+#endif
+#ifndef I2C_INLINE_UNUSED
+
+// Where the shared state lives. Normally in this file, with the internal
+// state static. In the header-only build (I2C_INLINE) every file gets its own
+// copy of the functions, so the state and the Interrupt Handlers are only
+// defined in the one file with I2C_IMPLEMENTATION, the others use it extern
+#if !defined(I2C_INLINE)
+	#define I2C_STATE static
+	#define I2C_STATE_DEFINE
+#elif defined(I2C_IMPLEMENTATION)
+	#define I2C_STATE
+	#define I2C_STATE_DEFINE
+#else
+	#define I2C_STATE extern
+#endif
+
+// Peripheral a bus runs on. In the header-only build a call on the default
+// bus is known at compile time, so its registers fold to constant addresses
+#ifdef I2C_INLINE
+	#define I2C_BUS_REGS(bus) (((bus) == &i2c_bus1) ? I2C1 : (bus)->regs)
+#else
+	#define I2C_BUS_REGS(bus) ((bus)->regs)
+#endif
+
+// Get the current SysTick Count, used for Timestamps and measurements
+#if defined(CH32V10x) || defined(CH32X03x)
+	#define I2C_TIMESTAMP() (SysTick->CNTL)
+#else
+	#define I2C_TIMESTAMP() ((uint32_t)SysTick->CNT)
+#endif
+
+// SysTick Counts per second
+#define I2C_TICKS_PER_SEC (DELAY_MS_TIME * 1000)
+
+// The helpers called on every wait are forced inline for speed. The Minimal
+// profile keeps one copy of each instead, to save flash
+#ifdef I2C_MINIMAL
+	#define I2C_HOT
+#else
+	#define I2C_HOT __attribute__((always_inline))
+#endif
+
+// Bus Lock, taken at the start of every transaction and given back at the
+// end. Returns [fail] if the lock could not be taken, or just returns from
+// functions with no return value (_VOID)
+#ifdef I2C_LOCK
+	#define I2C_LOCK_TAKE(bus, fail) \
+		if(i2c_lock_take(bus) != I2C_OK) return (fail)
+	#define I2C_LOCK_TAKE_VOID(bus) \
+		if(i2c_lock_take(bus) != I2C_OK) return
+	#define I2C_LOCK_GIVE(bus) i2c_bus_unlock(bus)
+#else
+	#define I2C_LOCK_TAKE(bus, fail)
+	#define I2C_LOCK_TAKE_VOID(bus)
+	#define I2C_LOCK_GIVE(bus)
+#endif
+
+/*** Transaction Trace *******************************************************/
+#ifdef I2C_TRACE
+#if (I2C_TRACE_DEPTH & (I2C_TRACE_DEPTH - 1)) != 0
+	#error "I2C_TRACE_DEPTH must be a power of 2"
+#endif
+
+#ifdef I2C_STATE_DEFINE
+volatile i2c_trace_t i2c_trace = {
+	.magic        = I2C_TRACE_MAGIC,
+	.depth        = I2C_TRACE_DEPTH,
+	.ticks_per_us = DELAY_US_TIME,
+	.rec_size     = sizeof(i2c_trace_rec_t),
+};
+#endif
+
+#ifdef I2C_TRACE_TIMING
+// SysTick Count when each phase of the current transaction was entered, with
+// bit 0 set so a reached phase is never 0
+I2C_STATE uint32_t i2c_trace_marks[I2C_PHASE_DONE];
+
+__attribute__((always_inline))
+static inline void i2c_trace_mark(const i2c_phase_t phase)
+{
+	i2c_trace_marks[phase] = I2C_TIMESTAMP() | 1;
+}
+#endif
+
+/// @brief Writes a single record into the Trace ring. Kept to a few stores so
+/// it does not disturb the bus timing
+/// @param bus, Bus the transaction ran on
+/// @param addr, reg, len, err, phase of the finished transaction
+/// @param bytes, Data bytes completed
+/// @return None
+__attribute__((always_inline))
+static inline void i2c_trace_log(i2c_bus_t *bus, const uint8_t addr,
+                                 const uint8_t reg, const uint8_t len,
+                                 const i2c_err_t err, const i2c_phase_t phase,
+                                 const uint8_t bytes)
+{
+	uint32_t idx = i2c_trace.head++ & (I2C_TRACE_DEPTH - 1);
+	volatile i2c_trace_rec_t *rec = &i2c_trace.rec[idx];
+	rec->timestamp = I2C_TIMESTAMP();
+	rec->addr   = addr;
+	rec->reg    = reg;
+	rec->len    = len;
+	rec->status = (uint8_t)((err << 4) | phase);
+
+	#ifdef I2C_TRACE_TIMING
+	I2C_TypeDef *I2Cx = I2C_BUS_REGS(bus);
+	rec->ckcfgr   = (I2Cx != NULL) ? I2Cx->CKCFGR : 0;
+	rec->pclk_mhz = (I2Cx != NULL) ? (I2Cx->CTLR2 & I2C_CTLR2_FREQ) : 0;
+	rec->bytes    = bytes;
+
+	// Each phase lasted until the next one reached, or the end
+	uint32_t next = rec->timestamp;
+	for(int8_t ph = I2C_PHASE_DONE - 1; ph >= 0; ph--)
+	{
+		const uint32_t mark = i2c_trace_marks[ph];
+		i2c_trace_marks[ph] = 0;
+		if(mark == 0) { rec->ticks[ph] = 0; continue; }
+
+		const uint32_t ticks = next - mark;
+		rec->ticks[ph] = (ticks == 0) ? 1 : ticks;
+		next = mark;
+	}
+	#endif
+}
+#else
+	#define i2c_trace_log(bus, addr, reg, len, err, phase, bytes) ((void)(phase))
+#endif
+
+#ifndef I2C_TRACE_TIMING
+	#define i2c_trace_mark(phase) ((void)(phase))
+#endif
+
+/*** Fault Injection *********************************************************/
+#ifdef I2C_FAULT
+#ifdef I2C_STATE_DEFINE
+i2c_fault_t i2c_fault;
+i2c_fault_stats_t i2c_fault_stats[I2C_FAULT_TYPES];
+#endif
+
+// Fault being recovered from (I2C_FAULT_NONE when 0), and when its first
+// failure was injected
+I2C_STATE i2c_fault_type_t i2c_fault_track;
+I2C_STATE uint32_t i2c_fault_start;
+
+// Set once an injected SCL_HELD or SDA_STUCK fault holds the bus, cleared
+// by i2c_bus_recover()
+I2C_STATE uint8_t i2c_fault_held;
+
+/// @brief Checks if the armed fault is due where the transaction is, and
+/// counts it as injected if it is
+/// @param phase, Phase the transaction is in
+/// @param byte, Data byte the transaction is on
+/// @return uint8_t 1 if the fault happens here
+static uint8_t i2c_fault_due(const i2c_phase_t phase, const uint8_t byte)
+{
+	if(i2c_fault.repeat == 0 || i2c_fault.phase != phase) return 0;
+	if(phase == I2C_PHASE_DATA && i2c_fault.byte != byte) return 0;
+
+	i2c_fault.repeat--;
+	i2c_fault_stats[i2c_fault.type].injected++;
+	if(i2c_fault_track == I2C_FAULT_NONE)
+	{
+		i2c_fault_track = i2c_fault.type;
+		i2c_fault_start = I2C_TIMESTAMP();
+	}
+	return 1;
+}
+
+/// @brief Fails the transaction if an armed NACK, ARLO or BERR fault matches
+/// where it is. Held lines are injected into the register waits instead
+/// @param err, error found so far, passed through if not I2C_OK
+/// @param phase, Phase the transaction is in
+/// @param byte, Data byte the transaction is on
+/// @return i2c_err_t [err], or the error the fault causes
+static i2c_err_t i2c_fault_check(const i2c_err_t err, const i2c_phase_t phase,
+                                                      const uint8_t byte)
+{
+	static const i2c_err_t fault_err[I2C_FAULT_SCL_HELD] = {
+		I2C_OK, I2C_ERR_NACK, I2C_ERR_ARLO, I2C_ERR_BERR,
+	};
+
+	if(err != I2C_OK || i2c_fault.type >= I2C_FAULT_SCL_HELD) return err;
+	if(!i2c_fault_due(phase, byte)) return err;
+	return fault_err[i2c_fault.type];
+}
+
+/// @brief Checks if a register wait should never see its status, as if a
+/// line were held. Once an SCL_HELD or SDA_STUCK fault fires, every wait
+/// stalls and times out until i2c_bus_recover() runs
+/// @param phase, Phase the transaction is in
+/// @param byte, Data byte the transaction is on
+/// @return uint8_t 1 to stall the wait
+static uint8_t i2c_fault_stall(const i2c_phase_t phase, const uint8_t byte)
+{
+	if(i2c_fault_held) return 1;
+	if(i2c_fault.type < I2C_FAULT_SCL_HELD) return 0;
+	return (i2c_fault_held = i2c_fault_due(phase, byte));
+}
+
+/// @brief Counts lost transactions while recovering from a fault, and the
+/// time taken once one succeeds
+/// @param err, Result of the finished transaction
+/// @return None
+__attribute__((always_inline))
+static inline void i2c_fault_log(const i2c_err_t err)
+{
+	if(i2c_fault_track == I2C_FAULT_NONE) return;
+
+	i2c_fault_stats_t *stats = &i2c_fault_stats[i2c_fault_track];
+	if(err != I2C_OK) { stats->lost++; return; }
+
+	const uint32_t recover_us = (I2C_TIMESTAMP() - i2c_fault_start) / DELAY_US_TIME;
+	stats->recoveries++;
+	stats->recover_us_total += recover_us;
+	if(recover_us > stats->recover_us_max) stats->recover_us_max = recover_us;
+	i2c_fault_track = I2C_FAULT_NONE;
+}
+
+	#define I2C_FAULT_AT(err, phase, byte) i2c_fault_check((err), (phase), (byte))
+	#define I2C_FAULT_STALL(phase, byte) i2c_fault_stall((phase), (byte))
+#else
+	#define I2C_FAULT_AT(err, phase, byte) (err)
+	#define I2C_FAULT_STALL(phase, byte) ((void)(phase), (void)(byte), 0)
+	#define i2c_fault_log(err) ((void)(err))
+#endif
+
 /*** Static Functions ********************************************************/
 /// @brief Checks the I2C Status against a mask value, returns 1 if it matches
+/// @param I2Cx, I2C Peripheral to check
 /// @param Status To match to
 /// @return uint32_t masked status value: 1 if mask and status match
 __attribute__((always_inline))
-static inline uint32_t i2c_status(const uint32_t status_mask)
+static inline uint32_t i2c_status(I2C_TypeDef *I2Cx, const uint32_t status_mask)
 {
-	uint32_t status = (uint32_t)I2C1->STAR1 | (uint32_t)(I2C1->STAR2 << 16);
+	uint32_t status = (uint32_t)I2Cx->STAR1 | (uint32_t)(I2Cx->STAR2 << 16);
 	return (status & status_mask) == status_mask; 
 }
 
 /// @brief Gets and returns any error state on the I2C Interface, and resets
-/// the bit flags
-/// @param none
+/// the bit flags. The status is saved into the busses result first
+/// @param bus, Bus to check
 /// @return i2c_err_t error value
-__attribute__((always_inline))
-static inline i2c_err_t i2c_error(void)
+I2C_HOT
+static inline i2c_err_t i2c_error(i2c_bus_t *bus)
 {
+	I2C_TypeDef *I2Cx = I2C_BUS_REGS(bus);
+	const uint16_t star1 = I2Cx->STAR1;
+	if(!(star1 & (I2C_STAR1_BERR | I2C_STAR1_AF | I2C_STAR1_ARLO | I2C_STAR1_OVR)))
+		return I2C_OK;
+
+	bus->result.star1 = star1;
+	bus->result.star2 = I2Cx->STAR2;
+
 	// BERR
-	if(I2C1->STAR1 & I2C_STAR1_BERR) {I2C1->STAR1 &= ~I2C_STAR1_BERR; return I2C_ERR_BERR;}
+	if(star1 & I2C_STAR1_BERR) {I2Cx->STAR1 &= ~I2C_STAR1_BERR; return I2C_ERR_BERR;}
 	// NACK
-	if(I2C1->STAR1 & I2C_STAR1_AF) {I2C1->STAR1 &= ~I2C_STAR1_AF; return I2C_ERR_NACK;}
+	if(star1 & I2C_STAR1_AF) {I2Cx->STAR1 &= ~I2C_STAR1_AF; return I2C_ERR_NACK;}
 	// ARLO
-	if(I2C1->STAR1 & I2C_STAR1_ARLO) {I2C1->STAR1 &= ~I2C_STAR1_ARLO; return I2C_ERR_ARLO;}
+	if(star1 & I2C_STAR1_ARLO) {I2Cx->STAR1 &= ~I2C_STAR1_ARLO; return I2C_ERR_ARLO;}
 	// OVR
-	if(I2C1->STAR1 & I2C_STAR1_OVR) {I2C1->STAR1 &= ~I2C_STAR1_OVR; return I2C_ERR_OVR;}
-
-	return I2C_OK;
+	I2Cx->STAR1 &= ~I2C_STAR1_OVR;
+	return I2C_ERR_OVR;
 }
 
 /// @brief Checks the current I2C Status, if it does not have an error state,
 /// it defaults to I2C_ERR_BUSY
-/// @param None
+/// @param bus, Bus to check
 /// @return i2c_err_t error value
-__attribute__((always_inline))
-static inline uint32_t i2c_get_busy_error(void)
+I2C_HOT
+static inline uint32_t i2c_get_busy_error(i2c_bus_t *bus)
 {
-	i2c_err_t i2c_err = i2c_error();
-	if(i2c_err == I2C_OK) i2c_err = I2C_ERR_BUSY;
+	i2c_err_t i2c_err = i2c_error(bus);
+	if(i2c_err == I2C_OK)
+	{
+		bus->result.star1 = I2C_BUS_REGS(bus)->STAR1;
+		bus->result.star2 = I2C_BUS_REGS(bus)->STAR2;
+		i2c_err = I2C_ERR_BUSY;
+	}
 	return i2c_err;
 }
 
+/// @brief Waits for the bus to reach a status. A NACK or other bus error
+/// stops TXE, RXNE and BTF from ever setting, so those are checked every pass.
+/// An injected SCL_HELD or SDA_STUCK fault makes the status never arrive
+/// @param bus, Bus to wait on
+/// @param status, I2C_EVENT_* or STAR1 Flag to wait for, eg I2C_STAR1_TXE
+/// @param phase, byte, where the transaction is, for Fault Injection
+/// @return i2c_err_t I2C_OK, the bus error, or I2C_ERR_BUSY on timeout
+I2C_HOT
+static inline i2c_err_t i2c_wait(i2c_bus_t *bus, const uint32_t status,
+                                 const i2c_phase_t phase, const uint8_t byte)
+{
+	const uint8_t stall = I2C_FAULT_STALL(phase, byte);
+	int32_t timeout = I2C_TIMEOUT;
+	while(stall || !i2c_status(I2C_BUS_REGS(bus), status))
+	{
+		const i2c_err_t i2c_err = i2c_error(bus);
+		if(i2c_err != I2C_OK) return i2c_err;
+		if(--timeout < 0) return i2c_get_busy_error(bus);
+	}
+	return I2C_OK;
+}
+
+/// @brief Ends a transaction, fills in the busses result and logs the
+/// transaction into the Trace
+/// @param bus, Bus the transaction ran on
+/// @param addr, reg, len, err, phase of the finished transaction. Bit 7 of
+/// addr is set for reads
+/// @param bytes, Data bytes completed
+/// @return None
+I2C_HOT
+static inline void i2c_finish(i2c_bus_t *bus, const uint8_t addr,
+                              const uint8_t reg, const uint8_t len,
+                              const i2c_err_t err, const i2c_phase_t phase,
+                              const uint8_t bytes)
+{
+	bus->result.err   = err;
+	bus->result.phase = phase;
+	bus->result.bytes = bytes;
 
+	// Failures were snapshotted when they were found
+	if(err == I2C_OK)
+	{
+		I2C_TypeDef *I2Cx = I2C_BUS_REGS(bus);
+		bus->result.star1 = (I2Cx != NULL) ? I2Cx->STAR1 : 0;
+		bus->result.star2 = (I2Cx != NULL) ? I2Cx->STAR2 : 0;
+	}
 
-/*** API Functions ***********************************************************/
-i2c_err_t i2c_init(uint32_t clk_rate)
+	i2c_trace_log(bus, addr, reg, len, err, phase, bytes);
+	i2c_fault_log(err);
+}
+
+
+/// @brief Switches the bus clock to [ckcfgr] if it is not already set.
+/// CKCFGR can only be written while PE is clear, so the peripheral is briefly
+/// disabled - GPIO, AFIO and the rest of the setup are left untouched
+/// @param I2Cx, I2C Peripheral to set
+/// @param ckcfgr, CKCFGR Register value to use
+/// @return None
+I2C_HOT
+static inline void i2c_set_ckcfgr(I2C_TypeDef *I2Cx, const uint16_t ckcfgr)
 {
-	// Toggle the I2C Reset bit to init Registers
-	RCC->APB1PRSTR |=  RCC_APB1Periph_I2C1;
-	RCC->APB1PRSTR &= ~RCC_APB1Periph_I2C1;
+	#ifdef I2C_SOFT_BUS
+	// Bit-banged busses run at the rate given to i2c_bus_init
+	if(I2Cx == NULL) return;
+	#endif
 
-	// Enable the I2C Peripheral Clock
-	RCC->APB1PCENR |= RCC_APB1Periph_I2C1;
+	// 0 is a device without a rate of its own, see I2C_CKCFGR()
+	if(ckcfgr == 0 || I2Cx->CKCFGR == ckcfgr) return;
 
-	// Enable the selected I2C Port, and the Alternate Function enable bit
-	RCC->APB2PCENR |= I2C_PORT_RCC | RCC_APB2Periph_AFIO;
+	// Let the previous STOP Condition finish before disabling the peripheral
+	int32_t timeout = I2C_TIMEOUT;
+	while(I2Cx->CTLR1 & I2C_CTLR1_STOP)
+		if(--timeout < 0) break;
 
-	// Reset the AFIO_PCFR1 register, then set it up
-	AFIO->PCFR1 &= ~(0x04400002);
-	AFIO->PCFR1 |= I2C_AFIO_REG;
+	I2Cx->CTLR1 &= ~I2C_CTLR1_PE;
+	I2Cx->CKCFGR = ckcfgr;
+	I2Cx->CTLR1 |= I2C_CTLR1_PE;
+}
 
-	// Clear, then set the GPIO Settings for SCL and SDA, on the selected port
-	I2C_PORT->CFGLR &= ~(0x0F << (4 * I2C_PIN_SDA));
-	I2C_PORT->CFGLR |= (GPIO_Speed_10MHz | GPIO_CNF_OUT_OD_AF) << (4 * I2C_PIN_SDA);	
-	I2C_PORT->CFGLR &= ~(0x0F << (4 * I2C_PIN_SCL));
-	I2C_PORT->CFGLR |= (GPIO_Speed_10MHz | GPIO_CNF_OUT_OD_AF) << (4 * I2C_PIN_SCL);
+/// @brief Sets the 4 configuration bits of a GPIO Pin, using CFGLR or CFGHR
+/// @param port, GPIO Port the pin is on
+/// @param pin, Pin number 0 - 15
+/// @param cfg, Speed and Mode bits, eg GPIO_Speed_10MHz | GPIO_CNF_OUT_OD_AF
+/// @return None
+static void i2c_pin_config(GPIO_TypeDef *port, const uint8_t pin,
+                                               const uint32_t cfg)
+{
+	volatile uint32_t *cfgr = (pin < 8) ? &port->CFGLR : &port->CFGHR;
+	const uint32_t shift = 4 * (pin & 0x07);
+
+	*cfgr = (*cfgr & ~(0x0F << shift)) | (cfg << shift);
+}
 
-	// Set the Prerate frequency
-	uint16_t i2c_conf = I2C1->CTLR2 & ~I2C_CTLR2_FREQ;
-	i2c_conf |= (FUNCONF_SYSTEM_CORE_CLOCK / I2C_PRERATE) & I2C_CTLR2_FREQ;
-	I2C1->CTLR2 = i2c_conf;
 
-	// Set I2C Clock
-	if(clk_rate <= 100000)
-	{
-		i2c_conf = (FUNCONF_SYSTEM_CORE_CLOCK / (2 * clk_rate)) & I2C_CKCFGR_CCR;
-	} else {
-		// Fast mode. Default to 33% Duty Cycle
-		i2c_conf = (FUNCONF_SYSTEM_CORE_CLOCK / (3 * clk_rate)) & I2C_CKCFGR_CCR;
-		i2c_conf |= I2C_CKCFGR_FS;
-	}
-	I2C1->CKCFGR = i2c_conf;
+/// @brief Gets the RCC Reset and Clock Enable bit for a peripheral
+/// @param I2Cx, I2C1 or I2C2
+/// @return uint32_t RCC_APB1Periph_I2Cx bit
+__attribute__((always_inline))
+static inline uint32_t i2c_rcc_bit(I2C_TypeDef *I2Cx)
+{
+	#ifdef I2C2
+	if(I2Cx == I2C2) return RCC_APB1Periph_I2C2;
+	#endif
+	return RCC_APB1Periph_I2C1;
+}
 
-	// Enable the I2C Peripheral
-	I2C1->CTLR1 |= I2C_CTLR1_PE;
 
-	//TODO:
-	// Check error states
-	if(I2C1->STAR1 & I2C_STAR1_BERR) 
-	{
-		I2C1->STAR1 &= ~(I2C_STAR1_BERR); 
-		return I2C_ERR_BERR;
-	}
+#ifdef I2C_DMA
+/// @brief Gets the DMA1 Channel for a peripherals TX or RX requests
+/// @param I2Cx, I2C1 or I2C2
+/// @param rx, 1 for the RX Channel, 0 for TX
+/// @return uint8_t DMA1 Channel number
+__attribute__((always_inline))
+static inline uint8_t i2c_dma_channel(I2C_TypeDef *I2Cx, const uint8_t rx)
+{
+	#ifdef I2C2
+	if(I2Cx == I2C2) return rx ? I2C2_DMA_RX : I2C2_DMA_TX;
+	#endif
+	return rx ? I2C1_DMA_RX : I2C1_DMA_TX;
+}
 
-	return I2C_OK;
+// DMA Channel owner name. Claims are matched by pointer, so there is one copy
+#ifdef I2C_STATE_DEFINE
+I2C_STATE const char i2c_dma_owner[] = "lib_i2c";
+#else
+extern const char i2c_dma_owner[];
+#endif
+#endif
+
+
+/// @brief Updates a CRC-16/CCITT with one byte
+/// @param crc, Current CRC
+/// @param byte, Next data byte
+/// @return uint16_t updated CRC
+__attribute__((always_inline))
+static inline uint16_t i2c_crc16_byte(uint16_t crc, const uint8_t byte)
+{
+	crc ^= (uint16_t)byte << 8;
+	for(uint8_t bit = 0; bit < 8; bit++)
+		crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+	return crc;
 }
 
 
-i2c_err_t i2c_ping(const uint8_t addr)
+#ifdef I2C_LOCK
+/// @brief Gets an ID for the running context. The main loop is 1, each
+/// Interrupt nesting level gets its own ID from the PFIC nesting status
+/// @param None
+/// @return uint8_t context ID, never 0
+__attribute__((always_inline))
+static inline uint8_t i2c_lock_context(void)
 {
-	i2c_err_t i2c_ret = I2C_OK;
+	return (PFIC->GISR & 0xFF) + 1;
+}
+
+/// @brief Takes the lock for a transaction. The main loop waits up to
+/// I2C_LOCK_TIMEOUT_US, Interrupts only try once
+/// @param bus, Bus Handle
+/// @return i2c_err_t, I2C_OK if taken
+__attribute__((always_inline))
+static inline i2c_err_t i2c_lock_take(i2c_bus_t *bus)
+{
+	return i2c_bus_lock(bus, (i2c_lock_context() == 1) ? I2C_LOCK_TIMEOUT_US : 0);
+}
+#endif
+
+
+/*** Software Bus ************************************************************/
+#ifdef I2C_SOFT_BUS
+// Working copy of a bit-banged busses pins, kept in registers during a transfer
+typedef struct {
+	GPIO_TypeDef *port;
+	uint32_t scl;       // SCL Pin Mask
+	uint32_t sda;       // SDA Pin Mask
+	uint32_t delay;     // Delay loops per half clock
+} i2c_sw_t;
+
+// Bit-banged transfer types
+#define I2C_SW_PING  0
+#define I2C_SW_READ  1
+#define I2C_SW_WRITE 2
+
+/// @brief Waits for half an SCL period
+/// @param sw, bit-banged bus
+/// @return None
+__attribute__((always_inline))
+static inline void i2c_sw_delay(const i2c_sw_t *sw)
+{
+	for(uint32_t loop = sw->delay; loop > 0; loop--) __asm__ volatile("");
+}
+
+/// @brief Releases SCL and waits for it to go high. A slave can hold SCL low
+/// to stretch the clock
+/// @param sw, bit-banged bus
+/// @return i2c_err_t, I2C_ERR_BUSY if SCL was held low for too long
+__attribute__((always_inline))
+static inline i2c_err_t i2c_sw_scl_high(const i2c_sw_t *sw)
+{
+	sw->port->BSHR = sw->scl;
 
-	// Wait for the bus to become not busy - return I2C_ERR_TIMEOUT on failure
 	int32_t timeout = I2C_TIMEOUT;
-	while(I2C1->STAR2 & I2C_STAR2_BUSY) 
-		if(--timeout < 0) i2c_ret = I2C_ERR_BUSY;
+	while(!(sw->port->INDR & sw->scl))
+		if(--timeout < 0) return I2C_ERR_BUSY;
 
-	if(i2c_ret == I2C_OK)
+	return I2C_OK;
+}
+
+/// @brief Sends a START, or Repeated START Condition. Leaves SCL low
+/// @param sw, bit-banged bus
+/// @return i2c_err_t, I2C_ERR_BUSY if another device is holding the bus
+static i2c_err_t i2c_sw_start(const i2c_sw_t *sw)
+{
+	// Release SDA while SCL is low, then release SCL
+	sw->port->BSHR = sw->sda;
+	i2c_sw_delay(sw);
+	if(i2c_sw_scl_high(sw) != I2C_OK) return I2C_ERR_BUSY;
+	if(!(sw->port->INDR & sw->sda)) return I2C_ERR_BUSY;
+	i2c_sw_delay(sw);
+
+	// SDA falling while SCL is high is the START Condition
+	sw->port->BCR = sw->sda;
+	i2c_sw_delay(sw);
+	sw->port->BCR = sw->scl;
+	return I2C_OK;
+}
+
+/// @brief Sends a STOP Condition, leaves both lines released
+/// @param sw, bit-banged bus
+/// @return None
+static void i2c_sw_stop(const i2c_sw_t *sw)
+{
+	sw->port->BCR = sw->sda;
+	i2c_sw_delay(sw);
+	i2c_sw_scl_high(sw);
+	i2c_sw_delay(sw);
+
+	// SDA rising while SCL is high is the STOP Condition
+	sw->port->BSHR = sw->sda;
+	i2c_sw_delay(sw);
+}
+
+/// @brief Clocks out one byte MSB first, then clocks in the ACK bit
+/// @param sw, bit-banged bus
+/// @param byte, to send
+/// @return i2c_err_t, I2C_ERR_NACK, or I2C_ERR_ARLO if another master drove
+/// SDA low while this one released it
+static i2c_err_t i2c_sw_write_byte(const i2c_sw_t *sw, uint8_t byte)
+{
+	for(uint8_t bit = 0; bit < 8; bit++)
 	{
-		// Send a START Signal and wait for it to assert
-		I2C1->CTLR1 |= I2C_CTLR1_START;
-		while(!i2c_status(I2C_EVENT_MASTER_MODE_SELECT));
+		// Set or Reset SDA with one store - BSHR resets with the upper 16 bits
+		const uint32_t release = byte & 0x80;
+		sw->port->BSHR = sw->sda << ((~byte & 0x80) >> 3);
+		byte <<= 1;
 
-		// Send the Address and wait for it to finish transmitting
-		timeout = I2C_TIMEOUT;
-		I2C1->DATAR = (addr << 1) & 0xFE;
-		// If the device times out, get the error status - if status is okay,
-		// return generic I2C_ERR_BUSY Flag
-		while(!i2c_status(I2C_EVENT_MASTER_TRANSMITTER_MODE_SELECTED))
-			if(--timeout < 0) {i2c_ret = i2c_get_busy_error(); break;}
+		i2c_sw_delay(sw);
+		if(i2c_sw_scl_high(sw) != I2C_OK) return I2C_ERR_BUSY;
+		if(release && !(sw->port->INDR & sw->sda)) return I2C_ERR_ARLO;
+		i2c_sw_delay(sw);
+		sw->port->BCR = sw->scl;
 	}
 
-	// Send the STOP Signal, return i2c status
-	I2C1->CTLR1 |= I2C_CTLR1_STOP;
-	return i2c_ret;
-}
+	// Release SDA and clock in the ACK Bit
+	sw->port->BSHR = sw->sda;
+	i2c_sw_delay(sw);
+	if(i2c_sw_scl_high(sw) != I2C_OK) return I2C_ERR_BUSY;
+	const uint32_t nack = sw->port->INDR & sw->sda;
+	i2c_sw_delay(sw);
+	sw->port->BCR = sw->scl;
 
+	return nack ? I2C_ERR_NACK : I2C_OK;
+}
 
-void i2c_scan(void (*callback)(const uint8_t))
+/// @brief Clocks in one byte MSB first, then sends ACK or NACK
+/// @param sw, bit-banged bus
+/// @param byte, pointer to store the byte in
+/// @param ack, 1 to ACK the byte (more to read), 0 to NACK it (last byte)
+/// @return i2c_err_t, I2C_OK on success
+static i2c_err_t i2c_sw_read_byte(const i2c_sw_t *sw, uint8_t *byte,
+                                                      const uint8_t ack)
 {
-	// If the callback function is null, exit
-	if(callback == NULL) return;
+	sw->port->BSHR = sw->sda;
 
-	// Scan through every address, getting a ping() response
-	for(uint8_t addr = 0x00; addr < 0x7F; addr++)
+	uint8_t value = 0;
+	for(uint8_t bit = 0; bit < 8; bit++)
 	{
-		// If the address responds, call the callback function
-		if(i2c_ping(addr) == I2C_OK) callback(addr);
+		i2c_sw_delay(sw);
+		if(i2c_sw_scl_high(sw) != I2C_OK) return I2C_ERR_BUSY;
+		value = (value << 1) | ((sw->port->INDR & sw->sda) != 0);
+		i2c_sw_delay(sw);
+		sw->port->BCR = sw->scl;
 	}
-}
+	*byte = value;
 
+	// ACK by pulling SDA low, NACK by leaving it released
+	if(ack) sw->port->BCR = sw->sda;
+	i2c_sw_delay(sw);
+	if(i2c_sw_scl_high(sw) != I2C_OK) return I2C_ERR_BUSY;
+	i2c_sw_delay(sw);
+	sw->port->BCR = sw->scl;
+	sw->port->BSHR = sw->sda;
 
-i2c_err_t i2c_read(const uint8_t addr,		const uint8_t reg,
-											uint8_t *buf,
-											const uint8_t len)
+	return I2C_OK;
+}
+
+/// @brief Runs a whole ping, read or write transaction on a bit-banged bus
+/// @param bus, Bus Handle with regs == NULL
+/// @param mode, I2C_SW_PING, I2C_SW_READ or I2C_SW_WRITE
+/// @param addr, reg, 7-Bit Address and Register
+/// @param rx, tx, buffers for READ and WRITE
+/// @param len, number of bytes to transfer
+/// @return i2c_err_t, I2C_OK on success
+static i2c_err_t i2c_sw_transfer(i2c_bus_t *bus, const uint8_t mode,
+                                                 const uint8_t addr,
+                                                 const uint8_t reg,
+                                                 uint8_t *rx,
+                                                 const uint8_t *tx,
+                                                 const uint8_t len)
 {
-	i2c_err_t i2c_ret = I2C_OK;
+	const i2c_sw_t sw = {
+		.port  = bus->pinout->port,
+		.scl   = 1 << bus->pinout->pin_scl,
+		.sda   = 1 << bus->pinout->pin_sda,
+		.delay = bus->sw_delay,
+	};
+
+	i2c_phase_t phase = I2C_PHASE_START;
+	i2c_trace_mark(phase);
+	uint8_t cbyte = 0;
+	i2c_err_t i2c_ret = i2c_sw_start(&sw);
 
-	// Wait for the bus to become not busy - set state to I2C_ERR_TIMEOUT on failure
-	int32_t timeout = I2C_TIMEOUT;
-	while(I2C1->STAR2 & I2C_STAR2_BUSY) 
-		if(--timeout < 0) {i2c_ret = i2c_get_busy_error(); break;}
-	
 	if(i2c_ret == I2C_OK)
 	{
-		// Send a START Signal and wait for it to assert
-		I2C1->CTLR1 |= I2C_CTLR1_START;
-		while(!i2c_status(I2C_EVENT_MASTER_MODE_SELECT));
-
-		// Send the Address and wait for it to finish transmitting
-		timeout = I2C_TIMEOUT;
-		I2C1->DATAR = (addr << 1) & 0xFE;
-		while(!i2c_status(I2C_EVENT_MASTER_TRANSMITTER_MODE_SELECTED))
-			if(--timeout < 0) {i2c_ret = i2c_get_busy_error(); break;}
+		phase = I2C_PHASE_ADDR;
+		i2c_trace_mark(phase);
+		i2c_ret = i2c_sw_write_byte(&sw, (addr << 1) & 0xFE);
 	}
 
-	if(i2c_ret == I2C_OK)
+	if(i2c_ret == I2C_OK && mode != I2C_SW_PING)
 	{
-		// Send the Register Byte
-		I2C1->DATAR = reg;
-		while(!(I2C1->STAR1 & I2C_STAR1_TXE));
-
-		// If the message is long enough, enable ACK messages
-		if(len > 1) I2C1->CTLR1 |= I2C_CTLR1_ACK;
-
-		// Send a Repeated START Signal and wait for it to assert
-		I2C1->CTLR1 |= I2C_CTLR1_START;
-		while(!i2c_status(I2C_EVENT_MASTER_MODE_SELECT));
+		phase = I2C_PHASE_REG;
+		i2c_trace_mark(phase);
+		i2c_ret = i2c_sw_write_byte(&sw, reg);
+	}
 
-		// Send Read Address
-		timeout = I2C_TIMEOUT;
-		I2C1->DATAR = (addr << 1) | 0x01;
-		while(!i2c_status(I2C_EVENT_MASTER_RECEIVER_MODE_SELECTED))
-			if(--timeout < 0) {i2c_ret = i2c_get_busy_error(); break;}
+	if(i2c_ret == I2C_OK && mode == I2C_SW_READ)
+	{
+		phase = I2C_PHASE_RESTART;
+		i2c_trace_mark(phase);
+		i2c_ret = i2c_sw_start(&sw);
+		if(i2c_ret == I2C_OK) i2c_ret = i2c_sw_write_byte(&sw, (addr << 1) | 0x01);
 	}
 
-	if(i2c_ret == I2C_OK)
+	if(i2c_ret == I2C_OK && mode != I2C_SW_PING)
 	{
-		// Read bytes
-		uint8_t cbyte = 0;
+		phase = I2C_PHASE_DATA;
+		i2c_trace_mark(phase);
 		while(cbyte < len)
 		{
-			// If this is the last byte, send the NACK Bit
-			if(cbyte == len) I2C1->CTLR1 &= ~I2C_CTLR1_ACK;
-
-			// Wait until the Read Register isn't empty
-			while(!(I2C1->STAR1 & I2C_STAR1_RXNE));
-			buf[cbyte] = I2C1->DATAR;
-
-			// Make sure no errors occured
-			if((i2c_ret = i2c_error()) != I2C_OK) break;
+			if(mode == I2C_SW_READ)
+				i2c_ret = i2c_sw_read_byte(&sw, &rx[cbyte], cbyte + 1 < len);
+			else
+				i2c_ret = i2c_sw_write_byte(&sw, tx[cbyte]);
 
+			if(i2c_ret != I2C_OK) break;
 			++cbyte;
 		}
 	}
 
-	// Send the STOP Condition to auto-reset for the next operation
-	I2C1->CTLR1 |= I2C_CTLR1_STOP;
+	if(i2c_ret == I2C_OK) phase = I2C_PHASE_DONE;
 
+	// After losing arbitration the bus belongs to the other master, so only
+	// let go of the lines. Otherwise send the STOP Condition
+	if(i2c_ret == I2C_ERR_ARLO)
+		sw.port->BSHR = sw.scl | sw.sda;
+	else
+		i2c_sw_stop(&sw);
+
+	bus->result.star1 = 0;
+	bus->result.star2 = 0;
+	i2c_finish(bus, addr | ((mode == I2C_SW_READ) ? 0x80 : 0x00), reg, len,
+	                                                  i2c_ret, phase, cbyte);
 	return i2c_ret;
 }
 
+/// @brief Sets the delay loop count of a bit-banged bus for [clk_rate]
+/// @param bus, Bus Handle with regs == NULL
+/// @param clk_rate, SCL Frequency in Hz
+/// @return None
+static void i2c_sw_set_delay(i2c_bus_t *bus, const uint32_t clk_rate)
+{
+	// Half an SCL period in CPU Cycles, less the time spent driving the pins
+	uint32_t half_cycles = FUNCONF_SYSTEM_CORE_CLOCK / (2 * clk_rate);
+	uint32_t delay = 0;
+	if(half_cycles > I2C_SOFT_OVERHEAD_CYCLES)
+		delay = (half_cycles - I2C_SOFT_OVERHEAD_CYCLES) / I2C_SOFT_LOOP_CYCLES;
+	bus->sw_delay = (delay > 0xFFFF) ? 0xFFFF : delay;
+}
 
-i2c_err_t i2c_write(const uint8_t addr,		const uint8_t reg,
-											const uint8_t *buf,
-											const uint8_t len)
+/// @brief Sets up the pins of a bit-banged bus as Open-Drain outputs, and
+/// calculates the delay for [clk_rate]
+/// @param bus, Bus Handle with regs == NULL
+/// @param clk_rate, SCL Frequency in Hz
+/// @return i2c_err_t, I2C_ERR_BUSY if a line is held low after setup
+static i2c_err_t i2c_sw_init(i2c_bus_t *bus, const uint32_t clk_rate)
 {
-	i2c_err_t i2c_ret = I2C_OK;
+	const i2c_pinout_t *pins = bus->pinout;
 
-	// Wait for the bus to become not busy - set state to I2C_ERR_TIMEOUT on failure
-	int32_t timeout = I2C_TIMEOUT;
-	while(I2C1->STAR2 & I2C_STAR2_BUSY) 
-		if(--timeout < 0) {i2c_ret = i2c_get_busy_error(); break;}
+	i2c_sw_set_delay(bus, clk_rate);
 
-	if(i2c_ret == I2C_OK)
+	// Release both lines before switching to outputs, so they never glitch low
+	RCC->APB2PCENR |= pins->port_rcc;
+	pins->port->BSHR = (1 << pins->pin_scl) | (1 << pins->pin_sda);
+	i2c_pin_config(pins->port, pins->pin_sda, GPIO_Speed_50MHz | GPIO_CNF_OUT_OD);
+	i2c_pin_config(pins->port, pins->pin_scl, GPIO_Speed_50MHz | GPIO_CNF_OUT_OD);
+
+	const uint32_t lines = (1 << pins->pin_scl) | (1 << pins->pin_sda);
+	if((pins->port->INDR & lines) != lines) return I2C_ERR_BUSY;
+	return I2C_OK;
+}
+#endif
+
+
+/*** Bus Handles *************************************************************/
+#ifdef I2C_STATE_DEFINE
+#if defined(CH32V003)
+const i2c_pinout_t i2c_pinout_default = {
+	.port = GPIOC, .port_rcc = RCC_APB2Periph_GPIOC,
+	.afio_mask = I2C_AFIO_MASK, .afio_reg = 0x00000000,
+	.pin_scl = 2, .pin_sda = 1,
+};
+
+const i2c_pinout_t i2c_pinout_alt_1 = {
+	.port = GPIOD, .port_rcc = RCC_APB2Periph_GPIOD,
+	.afio_mask = I2C_AFIO_MASK, .afio_reg = 0x04000002,
+	.pin_scl = 1, .pin_sda = 0,
+};
+
+const i2c_pinout_t i2c_pinout_alt_2 = {
+	.port = GPIOC, .port_rcc = RCC_APB2Periph_GPIOC,
+	.afio_mask = I2C_AFIO_MASK, .afio_reg = 0x00400002,
+	.pin_scl = 5, .pin_sda = 6,
+};
+#else
+const i2c_pinout_t i2c_pinout_default = {
+	.port = GPIOB, .port_rcc = RCC_APB2Periph_GPIOB,
+	.afio_mask = I2C_AFIO_MASK, .afio_reg = 0x00000000,
+	.pin_scl = 6, .pin_sda = 7,
+};
+
+const i2c_pinout_t i2c_pinout_alt_1 = {
+	.port = GPIOB, .port_rcc = RCC_APB2Periph_GPIOB,
+	.afio_mask = I2C_AFIO_MASK, .afio_reg = 0x00000002,
+	.pin_scl = 8, .pin_sda = 9,
+};
+#endif
+
+static const i2c_pinout_t i2c_bus1_pinout = {
+	.port      = I2C_PORT,
+	.port_rcc  = I2C_PORT_RCC,
+	.afio_mask = I2C_AFIO_MASK,
+	.afio_reg  = I2C_AFIO_REG,
+	.pin_scl   = I2C_PIN_SCL,
+	.pin_sda   = I2C_PIN_SDA,
+};
+
+i2c_bus_t i2c_bus1 = {
+	.regs   = I2C1,
+	.pinout = &i2c_bus1_pinout,
+};
+
+#ifdef I2C2
+static const i2c_pinout_t i2c_bus2_pinout = {
+	.port      = I2C2_PORT,
+	.port_rcc  = I2C2_PORT_RCC,
+	.afio_mask = 0,
+	.afio_reg  = 0,
+	.pin_scl   = I2C2_PIN_SCL,
+	.pin_sda   = I2C2_PIN_SDA,
+};
+
+i2c_bus_t i2c_bus2 = {
+	.regs   = I2C2,
+	.pinout = &i2c_bus2_pinout,
+};
+#endif
+#endif
+
+
+/*** API Functions ***********************************************************/
+I2C_API i2c_err_t i2c_bus_init(i2c_bus_t *bus, const uint32_t clk_rate)
+{
+	I2C_TypeDef *I2Cx = I2C_BUS_REGS(bus);
+	const i2c_pinout_t *pins = bus->pinout;
+
+	// A clock rate of 0 would divide by zero
+	if(clk_rate == 0) return I2C_ERR_INVALID;
+	I2C_LOCK_TAKE(bus, I2C_ERR_BUSY);
+
+	#ifdef I2C_SOFT_BUS
+	if(I2Cx == NULL)
 	{
-		// Send a START Signal and wait for it to assert
-		I2C1->CTLR1 |= I2C_CTLR1_START;
-		while(!i2c_status(I2C_EVENT_MASTER_MODE_SELECT));
+		const i2c_err_t sw_ret = i2c_sw_init(bus, clk_rate);
+		I2C_LOCK_GIVE(bus);
+		return sw_ret;
+	}
+	#endif
 
-		// Send the Address and wait for it to finish transmitting
-		timeout = I2C_TIMEOUT;
-		I2C1->DATAR = (addr << 1) & 0xFE;
-		while(!i2c_status(I2C_EVENT_MASTER_TRANSMITTER_MODE_SELECTED))
-			if(--timeout < 0) {i2c_ret = i2c_get_busy_error(); break;}
+	// Get the Reset and Clock Enable bit for the selected peripheral
+	const uint32_t i2c_rcc = i2c_rcc_bit(I2Cx);
+
+	// Toggle the I2C Reset bit to init Registers
+	RCC->APB1PRSTR |=  i2c_rcc;
+	RCC->APB1PRSTR &= ~i2c_rcc;
+
+	// Enable the I2C Peripheral Clock
+	RCC->APB1PCENR |= i2c_rcc;
+
+	// Enable the selected I2C Port, and the Alternate Function enable bit
+	RCC->APB2PCENR |= pins->port_rcc | RCC_APB2Periph_AFIO;
+
+	// Reset the AFIO_PCFR1 register, then set it up
+	AFIO->PCFR1 &= ~pins->afio_mask;
+	AFIO->PCFR1 |= pins->afio_reg;
+
+	// Clear, then set the GPIO Settings for SCL and SDA, on the selected port
+	i2c_pin_config(pins->port, pins->pin_sda, GPIO_Speed_10MHz | GPIO_CNF_OUT_OD_AF);
+	i2c_pin_config(pins->port, pins->pin_scl, GPIO_Speed_10MHz | GPIO_CNF_OUT_OD_AF);
+
+	// Set the Prerate frequency, in MHz of the peripherals input clock. The
+	// field tops out at 63MHz
+	uint32_t freq = I2C_PCLK / I2C_PRERATE;
+	if(freq > I2C_CTLR2_FREQ) freq = I2C_CTLR2_FREQ;
+	I2Cx->CTLR2 = (I2Cx->CTLR2 & ~I2C_CTLR2_FREQ) | freq;
+
+	// Set I2C Clock
+	I2Cx->CKCFGR = I2C_CKCFGR(clk_rate);
+
+	// Enable the I2C Peripheral
+	I2Cx->CTLR1 |= I2C_CTLR1_PE;
+
+	//TODO:
+	// Check error states
+	i2c_err_t i2c_ret = I2C_OK;
+	if(I2Cx->STAR1 & I2C_STAR1_BERR) 
+	{
+		I2Cx->STAR1 &= ~(I2C_STAR1_BERR); 
+		i2c_ret = I2C_ERR_BERR;
 	}
 
+	I2C_LOCK_GIVE(bus);
+	return i2c_ret;
+}
+
 
-	if(i2c_ret == I2C_OK)
+I2C_API i2c_err_t i2c_bus_remap(i2c_bus_t *bus, const i2c_pinout_t *pinout)
+{
+	I2C_TypeDef *I2Cx = I2C_BUS_REGS(bus);
+	const i2c_pinout_t *old = bus->pinout;
+	if(old == pinout) return I2C_OK;
+	I2C_LOCK_TAKE(bus, I2C_ERR_BUSY);
+
+	// Wait for any transaction, including its STOP Condition, to finish
+	if(I2Cx != NULL)
 	{
-		// Send the Register Byte
-		I2C1->DATAR = reg;
-		while(!(I2C1->STAR1 & I2C_STAR1_TXE));
+		int32_t timeout = I2C_TIMEOUT;
+		while((I2Cx->STAR2 & I2C_STAR2_BUSY) || (I2Cx->CTLR1 & I2C_CTLR1_STOP))
+			if(--timeout < 0) {I2C_LOCK_GIVE(bus); return I2C_ERR_BUSY;}
+	}
 
-		// Write bytes
-		uint8_t cbyte = 0;
-		while(cbyte < len)
-		{
-			// Write the byte and wait for it to finish transmitting
-			while(!(I2C1->STAR1 & I2C_STAR1_TXE));
-			I2C1->DATAR = buf[cbyte];
+	RCC->APB2PCENR |= pinout->port_rcc | RCC_APB2Periph_AFIO;
 
-			// Make sure no errors occured
-			if((i2c_ret = i2c_error()) != I2C_OK) break;
+	// Let go of the old pins, their pull-ups hold that group idle
+	i2c_pin_config(old->port, old->pin_sda, GPIO_CNF_IN_FLOATING);
+	i2c_pin_config(old->port, old->pin_scl, GPIO_CNF_IN_FLOATING);
 
-			++cbyte;
-		}
+	// Route the peripheral to the new pins, then hand them over to it
+	AFIO->PCFR1 = (AFIO->PCFR1 & ~pinout->afio_mask) | pinout->afio_reg;
 
-		// Wait for the bus to finish transmitting
-		while(!i2c_status(I2C_EVENT_MASTER_BYTE_TRANSMITTED));
+	uint32_t pin_cfg = GPIO_Speed_10MHz | GPIO_CNF_OUT_OD_AF;
+	#ifdef I2C_SOFT_BUS
+	if(I2Cx == NULL)
+	{
+		pinout->port->BSHR = (1 << pinout->pin_scl) | (1 << pinout->pin_sda);
+		pin_cfg = GPIO_Speed_50MHz | GPIO_CNF_OUT_OD;
 	}
+	#endif
+	i2c_pin_config(pinout->port, pinout->pin_sda, pin_cfg);
+	i2c_pin_config(pinout->port, pinout->pin_scl, pin_cfg);
 
-	// Send a STOP Condition, to aut-reset for the next operation
-	I2C1->CTLR1 |= I2C_CTLR1_STOP;
+	bus->pinout = pinout;
+	I2C_LOCK_GIVE(bus);
+	return I2C_OK;
+}
 
-	return i2c_ret;
+
+I2C_API i2c_err_t i2c_bus_set_clk_rate(i2c_bus_t *bus, const uint32_t clk_rate)
+{
+	if(clk_rate == 0) return I2C_ERR_INVALID;
+	I2C_LOCK_TAKE(bus, I2C_ERR_BUSY);
+
+	#ifdef I2C_SOFT_BUS
+	if(I2C_BUS_REGS(bus) == NULL) i2c_sw_set_delay(bus, clk_rate);
+	#endif
+	if(I2C_BUS_REGS(bus) != NULL) i2c_set_ckcfgr(I2C_BUS_REGS(bus), I2C_CKCFGR(clk_rate));
+
+	I2C_LOCK_GIVE(bus);
+	return I2C_OK;
 }
+
+
+/// @brief i2c_bus_recover(), called with the Bus Lock held
+static i2c_err_t i2c_recover_locked(i2c_bus_t *bus)
+{
+	I2C_TypeDef *I2Cx = I2C_BUS_REGS(bus);
+	const i2c_pinout_t *pins = bus->pinout;
+	const uint32_t scl = 1 << pins->pin_scl;
+	const uint32_t sda = 1 << pins->pin_sda;
+
+	// A device stuck mid-byte holds SDA low until it sees enough SCL pulses.
+	// Drive SCL as a GPIO until SDA is released, then send a STOP Condition
+	if(!(pins->port->INDR & sda))
+	{
+		pins->port->BSHR = scl | sda;
+		i2c_pin_config(pins->port, pins->pin_sda, GPIO_Speed_10MHz | GPIO_CNF_OUT_OD);
+		i2c_pin_config(pins->port, pins->pin_scl, GPIO_Speed_10MHz | GPIO_CNF_OUT_OD);
+
+		for(uint8_t pulse = 0; pulse < 9 && !(pins->port->INDR & sda); pulse++)
+		{
+			pins->port->BCR  = scl;
+			Delay_Us(5);
+			pins->port->BSHR = scl;
+			Delay_Us(5);
+		}
+
+		pins->port->BCR  = scl;
+		Delay_Us(5);
+		pins->port->BCR  = sda;
+		Delay_Us(5);
+		pins->port->BSHR = scl;
+		Delay_Us(5);
+		pins->port->BSHR = sda;
+		Delay_Us(5);
+
+		if(I2Cx != NULL)
+		{
+			i2c_pin_config(pins->port, pins->pin_sda, GPIO_Speed_10MHz | GPIO_CNF_OUT_OD_AF);
+			i2c_pin_config(pins->port, pins->pin_scl, GPIO_Speed_10MHz | GPIO_CNF_OUT_OD_AF);
+		}
+	}
+
+	// The injected held line is released along with any real one
+	#ifdef I2C_FAULT
+	i2c_fault_held = 0;
+	#endif
+
+	// Reset the peripheral logic only, then put its setup back
+	if(I2Cx != NULL)
+	{
+		i2c_state_t state;
+		i2c_bus_save(bus, &state);
+		I2Cx->CTLR1 |=  I2C_CTLR1_SWRST;
+		I2Cx->CTLR1 &= ~I2C_CTLR1_SWRST;
+		i2c_bus_restore(bus, &state);
+	}
+
+	if((pins->port->INDR & (scl | sda)) != (scl | sda)) return I2C_ERR_BUSY;
+	return I2C_OK;
+}
+
+
+I2C_API i2c_err_t i2c_bus_recover(i2c_bus_t *bus)
+{
+	I2C_LOCK_TAKE(bus, I2C_ERR_BUSY);
+	const i2c_err_t ret = i2c_recover_locked(bus);
+	I2C_LOCK_GIVE(bus);
+	return ret;
+}
+
+
+I2C_API void i2c_bus_save(i2c_bus_t *bus, i2c_state_t *state)
+{
+	I2C_TypeDef *I2Cx = I2C_BUS_REGS(bus);
+	if(I2Cx == NULL) return;
+	I2C_LOCK_TAKE_VOID(bus);
+
+	state->ctlr1  = I2Cx->CTLR1 & ~(I2C_CTLR1_START | I2C_CTLR1_STOP);
+	state->ctlr2  = I2Cx->CTLR2;
+	state->oaddr1 = I2Cx->OADDR1;
+	state->ckcfgr = I2Cx->CKCFGR;
+	I2C_LOCK_GIVE(bus);
+}
+
+
+I2C_API void i2c_bus_restore(i2c_bus_t *bus, const i2c_state_t *state)
+{
+	I2C_TypeDef *I2Cx = I2C_BUS_REGS(bus);
+	const i2c_pinout_t *pins = bus->pinout;
+	if(I2Cx == NULL) return;
+	I2C_LOCK_TAKE_VOID(bus);
+
+	RCC->APB1PCENR |= i2c_rcc_bit(I2Cx);
+	RCC->APB2PCENR |= pins->port_rcc | RCC_APB2Periph_AFIO;
+
+	// CKCFGR can only be written while PE is clear
+	I2Cx->CTLR1  &= ~I2C_CTLR1_PE;
+	I2Cx->CTLR2  = state->ctlr2;
+	I2Cx->OADDR1 = state->oaddr1;
+	I2Cx->CKCFGR = state->ckcfgr;
+	I2Cx->CTLR1  = state->ctlr1;
+
+	// Only hand the pins over once the peripheral is enabled and releasing them
+	AFIO->PCFR1 = (AFIO->PCFR1 & ~pins->afio_mask) | pins->afio_reg;
+	i2c_pin_config(pins->port, pins->pin_sda, GPIO_Speed_10MHz | GPIO_CNF_OUT_OD_AF);
+	i2c_pin_config(pins->port, pins->pin_scl, GPIO_Speed_10MHz | GPIO_CNF_OUT_OD_AF);
+	I2C_LOCK_GIVE(bus);
+}
+
+
+/// @brief Measures the rise time of one released, GPIO driven line. The
+/// line must be High on entry
+/// @param port, GPIO Port of the line
+/// @param mask, Pin mask of the line
+/// @return uint16_t average rise time in ns, 0xFFFF if it did not rise
+static uint16_t i2c_rise_time(GPIO_TypeDef *port, const uint32_t mask)
+{
+	const uint32_t timeout = I2C_RISE_TIMEOUT_US * DELAY_US_TIME;
+	uint32_t total = 0;
+
+	// Calibrate - time the same release and poll with the line already High.
+	// The fastest pass is the cost of the code, not of the line
+	uint32_t overhead = timeout;
+	for(uint8_t sample = 0; sample < I2C_RISE_SAMPLES; sample++)
+	{
+		const uint32_t start = I2C_TIMESTAMP();
+		port->BSHR = mask;
+		while(!(port->INDR & mask))
+			if((uint32_t)(I2C_TIMESTAMP() - start) > timeout) return 0xFFFF;
+		const uint32_t ticks = I2C_TIMESTAMP() - start;
+		if(ticks < overhead) overhead = ticks;
+	}
+
+	for(uint8_t sample = 0; sample < I2C_RISE_SAMPLES; sample++)
+	{
+		// Discharge the line fully, then time it after release
+		port->BCR = mask;
+		Delay_Us(2);
+
+		const uint32_t start = I2C_TIMESTAMP();
+		port->BSHR = mask;
+		while(!(port->INDR & mask))
+			if((uint32_t)(I2C_TIMESTAMP() - start) > timeout) return 0xFFFF;
+		const uint32_t ticks = I2C_TIMESTAMP() - start;
+		if(ticks > overhead) total += ticks - overhead;
+	}
+
+	const uint32_t rise_ns = (total * 1000) / (I2C_RISE_SAMPLES * DELAY_US_TIME);
+	return (rise_ns > 0xFFFE) ? 0xFFFE : rise_ns;
+}
+
+
+/// @brief i2c_bus_check(), called with the Bus Lock held
+static i2c_err_t i2c_check_locked(i2c_bus_t *bus, i2c_health_t *health)
+{
+	// Maximum rise time for each rate. 1MHz, 400kHz and 100kHz are the I2C
+	// Specification limits, the rates between are scaled from 400kHz. A rate
+	// is only picked if the limit is met with a full SysTick Count to spare,
+	// so the fast ones need the SysTick at HCLK (FUNCONF_SYSTICK_USE_HCLK)
+	static const struct { uint32_t rate; uint16_t rise_ns; } rise_max[] = {
+		{I2C_CLK_1MHZ,   120}, {I2C_CLK_750KHZ, 160}, {I2C_CLK_600KHZ, 200},
+		{I2C_CLK_500KHZ, 240}, {I2C_CLK_400KHZ, 300}, {I2C_CLK_100KHZ, 1000},
+		{I2C_CLK_50KHZ, 2000}, {I2C_CLK_10KHZ, 10000},
+	};
+
+	I2C_TypeDef *I2Cx = I2C_BUS_REGS(bus);
+	const i2c_pinout_t *pins = bus->pinout;
+	const uint32_t scl = 1 << pins->pin_scl;
+	const uint32_t sda = 1 << pins->pin_sda;
+
+	health->scl_rise_ns   = 0xFFFF;
+	health->sda_rise_ns   = 0xFFFF;
+	health->resolution_ns = 1000 / DELAY_US_TIME;
+	health->max_clk_rate  = 0;
+
+	// Sample the lines first, a line held low is also what makes the
+	// peripheral report BUSY. A line that stays low for 2ms, longer than a
+	// byte at 10KHz, is stuck rather than carrying a transaction
+	uint32_t seen = 0;
+	const uint32_t start = I2C_TIMESTAMP();
+	do { seen |= pins->port->INDR; }
+	while((seen & (scl | sda)) != (scl | sda) &&
+	      I2C_TIMESTAMP() - start <= I2C_TICKS_PER_SEC / 500);
+	health->scl_stuck = !(seen & scl);
+	health->sda_stuck = !(seen & sda);
+	if(health->scl_stuck || health->sda_stuck) return I2C_ERR_BUSY;
+
+	// Both lines high, but another master has the bus
+	if(I2Cx != NULL && (I2Cx->STAR2 & I2C_STAR2_BUSY)) return I2C_ERR_BUSY;
+
+	// Take the lines over as GPIO, starting released
+	pins->port->BSHR = scl | sda;
+	i2c_pin_config(pins->port, pins->pin_sda, GPIO_Speed_50MHz | GPIO_CNF_OUT_OD);
+	i2c_pin_config(pins->port, pins->pin_scl, GPIO_Speed_50MHz | GPIO_CNF_OUT_OD);
+
+	// SCL pulses while SDA is high and there was no START are ignored. SDA is
+	// only toggled while SCL is held low
+	health->scl_rise_ns = i2c_rise_time(pins->port, scl);
+	pins->port->BCR = scl;
+	health->sda_rise_ns = i2c_rise_time(pins->port, sda);
+	pins->port->BSHR = scl;
+
+	// Give the pins back to the peripheral
+	if(I2Cx != NULL)
+	{
+		i2c_pin_config(pins->port, pins->pin_sda, GPIO_Speed_10MHz | GPIO_CNF_OUT_OD_AF);
+		i2c_pin_config(pins->port, pins->pin_scl, GPIO_Speed_10MHz | GPIO_CNF_OUT_OD_AF);
+	}
+
+	const uint16_t rise = (health->scl_rise_ns > health->sda_rise_ns)
+	                      ? health->scl_rise_ns : health->sda_rise_ns;
+	for(uint8_t idx = 0; idx < sizeof(rise_max) / sizeof(rise_max[0]); idx++)
+	{
+		if(rise + health->resolution_ns <= rise_max[idx].rise_ns)
+		{
+			health->max_clk_rate = rise_max[idx].rate;
+			break;
+		}
+	}
+
+	if(rise == 0xFFFF) return I2C_ERR_BUSY;
+	return I2C_OK;
+}
+
+
+I2C_API i2c_err_t i2c_bus_check(i2c_bus_t *bus, i2c_health_t *health)
+{
+	I2C_LOCK_TAKE(bus, I2C_ERR_BUSY);
+	const i2c_err_t ret = i2c_check_locked(bus, health);
+	I2C_LOCK_GIVE(bus);
+	return ret;
+}
+
+
+I2C_API void i2c_bus_irq_priority(i2c_bus_t *bus, const uint8_t ev_prio,
+                                                  const uint8_t er_prio)
+{
+	IRQn_Type ev_irq = I2C1_EV_IRQn;
+	IRQn_Type er_irq = I2C1_ER_IRQn;
+	#ifdef I2C2
+	if(I2C_BUS_REGS(bus) == I2C2) { ev_irq = I2C2_EV_IRQn; er_irq = I2C2_ER_IRQn; }
+	#endif
+
+	NVIC_SetPriority(ev_irq, ev_prio);
+	NVIC_SetPriority(er_irq, er_prio);
+}
+
+
+I2C_API i2c_err_t i2c_bus_ping(i2c_bus_t *bus, const uint8_t addr)
+{
+	I2C_TypeDef *I2Cx = I2C_BUS_REGS(bus);
+	I2C_LOCK_TAKE(bus, I2C_ERR_BUSY);
+
+	#ifdef I2C_SOFT_BUS
+	if(I2Cx == NULL)
+	{
+		const i2c_err_t sw_ret = i2c_sw_transfer(bus, I2C_SW_PING, addr, 0x00, NULL, NULL, 0);
+		I2C_LOCK_GIVE(bus);
+		return sw_ret;
+	}
+	#endif
+
+	i2c_err_t i2c_ret = I2C_OK;
+	i2c_phase_t phase = I2C_PHASE_IDLE;
+	i2c_trace_mark(phase);
+
+	// Wait for the bus to become not busy - return I2C_ERR_BUSY on failure
+	int32_t timeout = I2C_TIMEOUT;
+	const uint8_t stall = I2C_FAULT_STALL(I2C_PHASE_IDLE, 0);
+	while(stall || (I2Cx->STAR2 & I2C_STAR2_BUSY))
+		if(--timeout < 0) {i2c_ret = i2c_get_busy_error(bus); break;}
+	i2c_ret = I2C_FAULT_AT(i2c_ret, I2C_PHASE_IDLE, 0);
+
+	if(i2c_ret == I2C_OK)
+	{
+		// Send a START Signal and wait for it to assert
+		phase = I2C_PHASE_START;
+		i2c_trace_mark(phase);
+		I2Cx->CTLR1 |= I2C_CTLR1_START;
+		i2c_ret = i2c_wait(bus, I2C_EVENT_MASTER_MODE_SELECT, phase, 0);
+	}
+
+	if(i2c_ret == I2C_OK)
+	{
+		// Send the Address and wait for it to finish transmitting
+		phase = I2C_PHASE_ADDR;
+		i2c_trace_mark(phase);
+		I2Cx->DATAR = (addr << 1) & 0xFE;
+		// If the device times out, get the error status - if status is okay,
+		// return generic I2C_ERR_BUSY Flag
+		i2c_ret = i2c_wait(bus, I2C_EVENT_MASTER_TRANSMITTER_MODE_SELECTED, phase, 0);
+		i2c_ret = I2C_FAULT_AT(i2c_ret, phase, 0);
+	}
+
+	if(i2c_ret == I2C_OK) phase = I2C_PHASE_DONE;
+
+	// Send the STOP Signal, return i2c status
+	I2Cx->CTLR1 |= I2C_CTLR1_STOP;
+	i2c_finish(bus, addr, 0x00, 0, i2c_ret, phase, 0);
+	I2C_LOCK_GIVE(bus);
+	return i2c_ret;
+}
+
+
+I2C_API void i2c_bus_scan(i2c_bus_t *bus, void (*callback)(const uint8_t))
+{
+	// If the callback function is null, exit
+	if(callback == NULL) return;
+
+	// Scan through every address, getting a ping() response
+	for(uint8_t addr = 0x00; addr < 0x7F; addr++)
+	{
+		// If the address responds, call the callback function
+		if(i2c_bus_ping(bus, addr) == I2C_OK) callback(addr);
+	}
+}
+
+
+I2C_API_HOT i2c_err_t i2c_bus_read(i2c_bus_t *bus, const uint8_t addr,
+                                               const uint8_t reg,
+                                               uint8_t *buf,
+                                               const uint8_t len)
+{
+	I2C_TypeDef *I2Cx = I2C_BUS_REGS(bus);
+	I2C_LOCK_TAKE(bus, I2C_ERR_BUSY);
+
+	#ifdef I2C_SOFT_BUS
+	if(I2Cx == NULL)
+	{
+		const i2c_err_t sw_ret = i2c_sw_transfer(bus, I2C_SW_READ, addr, reg, buf, NULL, len);
+		I2C_LOCK_GIVE(bus);
+		return sw_ret;
+	}
+	#endif
+
+	i2c_err_t i2c_ret = I2C_OK;
+	i2c_phase_t phase = I2C_PHASE_IDLE;
+	i2c_trace_mark(phase);
+	uint8_t cbyte = 0;
+
+	// Wait for the bus to become not busy - set state to I2C_ERR_BUSY on failure
+	int32_t timeout = I2C_TIMEOUT;
+	const uint8_t stall = I2C_FAULT_STALL(I2C_PHASE_IDLE, 0);
+	while(stall || (I2Cx->STAR2 & I2C_STAR2_BUSY))
+		if(--timeout < 0) {i2c_ret = i2c_get_busy_error(bus); break;}
+	i2c_ret = I2C_FAULT_AT(i2c_ret, I2C_PHASE_IDLE, 0);
+	
+	if(i2c_ret == I2C_OK)
+	{
+		// Send a START Signal and wait for it to assert
+		phase = I2C_PHASE_START;
+		i2c_trace_mark(phase);
+		I2Cx->CTLR1 |= I2C_CTLR1_START;
+		i2c_ret = i2c_wait(bus, I2C_EVENT_MASTER_MODE_SELECT, phase, 0);
+	}
+
+	if(i2c_ret == I2C_OK)
+	{
+		// Send the Address and wait for it to finish transmitting
+		phase = I2C_PHASE_ADDR;
+		i2c_trace_mark(phase);
+		I2Cx->DATAR = (addr << 1) & 0xFE;
+		i2c_ret = i2c_wait(bus, I2C_EVENT_MASTER_TRANSMITTER_MODE_SELECTED, phase, 0);
+		i2c_ret = I2C_FAULT_AT(i2c_ret, phase, 0);
+	}
+
+	if(i2c_ret == I2C_OK)
+	{
+		// Send the Register Byte, and make sure it was ACKed
+		phase = I2C_PHASE_REG;
+		i2c_trace_mark(phase);
+		I2Cx->DATAR = reg;
+		i2c_ret = I2C_FAULT_AT(i2c_wait(bus, I2C_STAR1_BTF, phase, 0), phase, 0);
+	}
+
+	if(i2c_ret == I2C_OK)
+	{
+		// If the message is long enough, enable ACK messages
+		if(len > 1) I2Cx->CTLR1 |= I2C_CTLR1_ACK;
+
+		// Send a Repeated START Signal and wait for it to assert
+		phase = I2C_PHASE_RESTART;
+		i2c_trace_mark(phase);
+		I2Cx->CTLR1 |= I2C_CTLR1_START;
+		i2c_ret = i2c_wait(bus, I2C_EVENT_MASTER_MODE_SELECT, phase, 0);
+	}
+
+	if(i2c_ret == I2C_OK)
+	{
+		// Send Read Address
+		I2Cx->DATAR = (addr << 1) | 0x01;
+		i2c_ret = i2c_wait(bus, I2C_EVENT_MASTER_RECEIVER_MODE_SELECTED, phase, 0);
+		i2c_ret = I2C_FAULT_AT(i2c_ret, phase, 0);
+	}
+
+	if(i2c_ret == I2C_OK)
+	{
+		// Read bytes
+		phase = I2C_PHASE_DATA;
+		i2c_trace_mark(phase);
+		while(cbyte < len)
+		{
+			// If this is the last byte, send the NACK Bit
+			if(cbyte == len - 1) I2Cx->CTLR1 &= ~I2C_CTLR1_ACK;
+
+			// Wait until the Read Register isn't empty
+			if((i2c_ret = i2c_wait(bus, I2C_STAR1_RXNE, phase, cbyte)) != I2C_OK) break;
+			buf[cbyte] = I2Cx->DATAR;
+
+			// Make sure no errors occured
+			if((i2c_ret = I2C_FAULT_AT(i2c_error(bus), phase, cbyte)) != I2C_OK) break;
+
+			++cbyte;
+		}
+	}
+
+	if(i2c_ret == I2C_OK) phase = I2C_PHASE_DONE;
+
+	// Send the STOP Condition to auto-reset for the next operation
+	I2Cx->CTLR1 |= I2C_CTLR1_STOP;
+
+	i2c_finish(bus, addr | 0x80, reg, len, i2c_ret, phase, cbyte);
+	I2C_LOCK_GIVE(bus);
+	return i2c_ret;
+}
+
+
+I2C_API_HOT i2c_err_t i2c_bus_write(i2c_bus_t *bus, const uint8_t addr,
+                                                const uint8_t reg,
+                                                const uint8_t *buf,
+                                                const uint8_t len)
+{
+	I2C_TypeDef *I2Cx = I2C_BUS_REGS(bus);
+	I2C_LOCK_TAKE(bus, I2C_ERR_BUSY);
+
+	#ifdef I2C_SOFT_BUS
+	if(I2Cx == NULL)
+	{
+		const i2c_err_t sw_ret = i2c_sw_transfer(bus, I2C_SW_WRITE, addr, reg, NULL, buf, len);
+		I2C_LOCK_GIVE(bus);
+		return sw_ret;
+	}
+	#endif
+
+	i2c_err_t i2c_ret = I2C_OK;
+	i2c_phase_t phase = I2C_PHASE_IDLE;
+	i2c_trace_mark(phase);
+	uint8_t cbyte = 0;
+
+	// Wait for the bus to become not busy - set state to I2C_ERR_BUSY on failure
+	int32_t timeout = I2C_TIMEOUT;
+	const uint8_t stall = I2C_FAULT_STALL(I2C_PHASE_IDLE, 0);
+	while(stall || (I2Cx->STAR2 & I2C_STAR2_BUSY))
+		if(--timeout < 0) {i2c_ret = i2c_get_busy_error(bus); break;}
+	i2c_ret = I2C_FAULT_AT(i2c_ret, I2C_PHASE_IDLE, 0);
+
+	if(i2c_ret == I2C_OK)
+	{
+		// Send a START Signal and wait for it to assert
+		phase = I2C_PHASE_START;
+		i2c_trace_mark(phase);
+		I2Cx->CTLR1 |= I2C_CTLR1_START;
+		i2c_ret = i2c_wait(bus, I2C_EVENT_MASTER_MODE_SELECT, phase, 0);
+	}
+
+	if(i2c_ret == I2C_OK)
+	{
+		// Send the Address and wait for it to finish transmitting
+		phase = I2C_PHASE_ADDR;
+		i2c_trace_mark(phase);
+		I2Cx->DATAR = (addr << 1) & 0xFE;
+		i2c_ret = i2c_wait(bus, I2C_EVENT_MASTER_TRANSMITTER_MODE_SELECTED, phase, 0);
+		i2c_ret = I2C_FAULT_AT(i2c_ret, phase, 0);
+	}
+
+
+	if(i2c_ret == I2C_OK)
+	{
+		// Send the Register Byte, and make sure it was ACKed before any data
+		phase = I2C_PHASE_REG;
+		i2c_trace_mark(phase);
+		I2Cx->DATAR = reg;
+		i2c_ret = I2C_FAULT_AT(i2c_wait(bus, I2C_STAR1_BTF, phase, 0), phase, 0);
+	}
+
+	if(i2c_ret == I2C_OK)
+	{
+		// Write bytes
+		phase = I2C_PHASE_DATA;
+		i2c_trace_mark(phase);
+		while(cbyte < len)
+		{
+			// Wait for room in the Data Register, then load the byte
+			if((i2c_ret = i2c_wait(bus, I2C_STAR1_TXE, phase, cbyte)) != I2C_OK) break;
+			I2Cx->DATAR = buf[cbyte];
+
+			// Make sure no errors occured
+			if((i2c_ret = I2C_FAULT_AT(i2c_error(bus), phase, cbyte)) != I2C_OK) break;
+
+			++cbyte;
+		}
+
+		// Wait for the bus to finish transmitting. A NACK of the last byte
+		// shows up here, and stops BTF from ever setting
+		if(i2c_ret == I2C_OK) i2c_ret = i2c_wait(bus, I2C_STAR1_BTF, phase, cbyte);
+
+		// DATAR is double buffered, so a NACK refers to the byte before the
+		// one just loaded
+		if(i2c_ret != I2C_OK && cbyte > 0) --cbyte;
+	}
+
+	if(i2c_ret == I2C_OK) phase = I2C_PHASE_DONE;
+
+	// Send a STOP Condition, to aut-reset for the next operation
+	I2Cx->CTLR1 |= I2C_CTLR1_STOP;
+
+	i2c_finish(bus, addr, reg, len, i2c_ret, phase, cbyte);
+	I2C_LOCK_GIVE(bus);
+	return i2c_ret;
+}
+
+
+I2C_API i2c_err_t i2c_bus_load_start(i2c_bus_t *bus, const uint8_t addr,
+                                                     const uint16_t mem_addr,
+                                                     uint8_t *buf,
+                                                     const uint16_t len,
+                                                     i2c_load_t *load)
+{
+	I2C_TypeDef *I2Cx = I2C_BUS_REGS(bus);
+
+	load->err   = I2C_OK;
+	load->phase = I2C_PHASE_IDLE;
+	#ifdef I2C_LOCK
+	load->locked = 0;
+	#endif
+
+	#ifdef I2C_SOFT_BUS
+	if(I2Cx == NULL) return (load->err = I2C_ERR_BUSY);
+	#endif
+
+	#ifndef I2C_MINIMAL
+	// Saved before anything can fail, i2c_bus_load_finish() puts the clock
+	// back and times the load however far it got
+	load->ckcfgr = I2Cx->CKCFGR;
+	load->start  = I2C_TIMESTAMP();
+	#endif
+
+	// Nothing to read. A DMA Channel with a count of 0 never finishes
+	if(len == 0) return (load->err = I2C_ERR_INVALID);
+
+	// The lock is held until i2c_bus_load_finish()
+	#ifdef I2C_LOCK
+	load->locked = (i2c_lock_take(bus) == I2C_OK);
+	if(!load->locked) return (load->err = I2C_ERR_BUSY);
+	#endif
+
+	#ifdef I2C_DMA
+	// Claim the RX Channel on first use, so polled and Slave only setups
+	// leave it free. Fails if another library holds it
+	if(DMAClaim(i2c_dma_channel(I2Cx, 1), i2c_dma_owner, NULL, NULL))
+		return (load->err = I2C_ERR_BUSY);
+	#endif
+
+	#ifndef I2C_MINIMAL
+	// Run at the fastest rate the line rise times allow, unless given one.
+	// The Minimal profile stays at the rate given to i2c_init()
+	uint32_t clk_rate = load->clk_rate;
+	if(clk_rate == 0)
+	{
+		i2c_health_t health;
+		if((load->err = i2c_bus_check(bus, &health)) != I2C_OK) return load->err;
+		clk_rate = health.max_clk_rate;
+	}
+	if(clk_rate != 0) i2c_set_ckcfgr(I2Cx, I2C_CKCFGR(clk_rate));
+	load->used_rate = i2c_ckcfgr_rate(I2Cx->CKCFGR);
+	#endif
+	i2c_trace_mark(I2C_PHASE_IDLE);
+
+	// Wait for the bus to become not busy - set state to I2C_ERR_BUSY on failure
+	int32_t timeout = I2C_TIMEOUT;
+	const uint8_t stall = I2C_FAULT_STALL(I2C_PHASE_IDLE, 0);
+	while(stall || (I2Cx->STAR2 & I2C_STAR2_BUSY))
+		if(--timeout < 0) {load->err = i2c_get_busy_error(bus); break;}
+
+	if(load->err == I2C_OK)
+	{
+		// Send a START Signal and wait for it to assert
+		load->phase = I2C_PHASE_START;
+		i2c_trace_mark(load->phase);
+		I2Cx->CTLR1 |= I2C_CTLR1_START;
+		load->err = i2c_wait(bus, I2C_EVENT_MASTER_MODE_SELECT, load->phase, 0);
+	}
+
+	if(load->err == I2C_OK)
+	{
+		// Send the Address and wait for it to finish transmitting
+		load->phase = I2C_PHASE_ADDR;
+		i2c_trace_mark(load->phase);
+		I2Cx->DATAR = (addr << 1) & 0xFE;
+		load->err = i2c_wait(bus, I2C_EVENT_MASTER_TRANSMITTER_MODE_SELECTED, load->phase, 0);
+	}
+
+	if(load->err == I2C_OK)
+	{
+		// Send the Memory Address, High Byte first
+		load->phase = I2C_PHASE_REG;
+		i2c_trace_mark(load->phase);
+		if(load->addr_bytes > 1)
+		{
+			I2Cx->DATAR = mem_addr >> 8;
+			load->err = i2c_wait(bus, I2C_STAR1_TXE, load->phase, 0);
+		}
+
+		// Make sure the memory accepted the address before reading
+		if(load->err == I2C_OK)
+		{
+			I2Cx->DATAR = mem_addr & 0xFF;
+			load->err = i2c_wait(bus, I2C_STAR1_BTF, load->phase, 0);
+		}
+	}
+
+	if(load->err == I2C_OK)
+	{
+		// ACK every byte but the last
+		if(len > 1) I2Cx->CTLR1 |= I2C_CTLR1_ACK;
+		else        I2Cx->CTLR1 &= ~I2C_CTLR1_ACK;
+
+		// Send a Repeated START Signal and wait for it to assert
+		load->phase = I2C_PHASE_RESTART;
+		i2c_trace_mark(load->phase);
+		I2Cx->CTLR1 |= I2C_CTLR1_START;
+		load->err = i2c_wait(bus, I2C_EVENT_MASTER_MODE_SELECT, load->phase, 0);
+	}
+
+	if(load->err == I2C_OK)
+	{
+		#ifdef I2C_DMA
+		// Arm the RX Channel. LAST makes the peripheral NACK the final byte.
+		// Only once SB is set - with TXE or BTF still set from the Memory
+		// Address, DMAEN would request the TX Channel, which is not claimed
+		DMA_Channel_TypeDef *dma = DMAChannel(i2c_dma_channel(I2Cx, 1));
+		dma->CFGR  = 0;
+		dma->PADDR = (uint32_t)&I2Cx->DATAR;
+		dma->MADDR = (uint32_t)buf;
+		dma->CNTR  = len;
+		dma->CFGR  = DMA_CFGR1_MINC | DMA_CFGR1_PL_1 | DMA_CFGR1_EN;
+		I2Cx->CTLR2 |= I2C_CTLR2_DMAEN | I2C_CTLR2_LAST;
+		#endif
+
+		// Send Read Address
+		I2Cx->DATAR = (addr << 1) | 0x01;
+		load->err = i2c_wait(bus, I2C_EVENT_MASTER_RECEIVER_MODE_SELECTED, load->phase, 0);
+	}
+
+	if(load->err == I2C_OK)
+	{
+		load->phase = I2C_PHASE_DATA;
+		i2c_trace_mark(load->phase);
+	}
+	return load->err;
+}
+
+
+I2C_API i2c_err_t i2c_bus_load_finish(i2c_bus_t *bus, const uint8_t addr,
+                                                      const uint16_t mem_addr,
+                                                      uint8_t *buf,
+                                                      const uint16_t len,
+                                                      i2c_load_t *load)
+{
+	I2C_TypeDef *I2Cx = I2C_BUS_REGS(bus);
+	i2c_err_t i2c_ret = load->err;
+	uint16_t cbyte = 0;
+	#ifndef I2C_MINIMAL
+	uint16_t crc = I2C_CRC16_INIT;
+	#endif
+
+	#ifdef I2C_LOCK
+	// The lock was never taken, leave the bus to its owner
+	if(!load->locked) return i2c_ret;
+	load->locked = 0;
+	#endif
+
+	#ifdef I2C_SOFT_BUS
+	if(I2Cx == NULL) return i2c_ret;
+	#endif
+
+	#ifdef I2C_DMA
+	DMA_Channel_TypeDef *dma = DMAChannel(i2c_dma_channel(I2Cx, 1));
+	#endif
+
+	if(i2c_ret == I2C_OK)
+	{
+		// Read bytes, checksumming each as it arrives. Give up if no byte
+		// arrives for 2ms, one byte at 10KHz takes 0.9ms
+		uint32_t last = I2C_TIMESTAMP();
+		while(cbyte < len)
+		{
+			#ifdef I2C_DMA
+			// Follow the DMA Channel, it has written everything up to [done]
+			const uint16_t done = len - dma->CNTR;
+			if(cbyte < done)
+			{
+				while(cbyte < done) crc = i2c_crc16_byte(crc, buf[cbyte++]);
+				last = I2C_TIMESTAMP();
+				continue;
+			}
+			#else
+			// If this is the last byte, send the NACK Bit
+			if(cbyte == len - 1) I2Cx->CTLR1 &= ~I2C_CTLR1_ACK;
+
+			if(I2Cx->STAR1 & I2C_STAR1_RXNE)
+			{
+				#ifdef I2C_MINIMAL
+				buf[cbyte++] = I2Cx->DATAR;
+				#else
+				buf[cbyte] = I2Cx->DATAR;
+				crc = i2c_crc16_byte(crc, buf[cbyte++]);
+				#endif
+				last = I2C_TIMESTAMP();
+				continue;
+			}
+			#endif
+
+			// Nothing new, make sure the bus has not failed or stalled
+			if((i2c_ret = i2c_error(bus)) != I2C_OK) break;
+			if(I2C_TIMESTAMP() - last > I2C_TICKS_PER_SEC / 500)
+				{i2c_ret = i2c_get_busy_error(bus); break;}
+		}
+	}
+
+	#ifdef I2C_DMA
+	// Not claimed if the load never left IDLE, leave the channel to its owner
+	if(load->phase != I2C_PHASE_IDLE) dma->CFGR &= ~DMA_CFGR1_EN;
+	I2Cx->CTLR2 &= ~(I2C_CTLR2_DMAEN | I2C_CTLR2_LAST);
+	#endif
+
+	i2c_phase_t phase = load->phase;
+	if(i2c_ret == I2C_OK) phase = I2C_PHASE_DONE;
+
+	// Send the STOP Condition if the transaction got started
+	if(load->phase != I2C_PHASE_IDLE) I2Cx->CTLR1 |= I2C_CTLR1_STOP;
+	load->bytes = cbyte;
+
+	#ifndef I2C_MINIMAL
+	// Put the previous clock back, then fill in the report
+	load->time_us = (I2C_TIMESTAMP() - load->start) / DELAY_US_TIME;
+	i2c_set_ckcfgr(I2Cx, load->ckcfgr);
+
+	load->crc = crc;
+	if(i2c_ret == I2C_OK && load->verify && crc != load->crc_expect)
+		i2c_ret = I2C_ERR_VERIFY;
+	#endif
+
+	// The result and trace only have room for 8 bit lengths
+	i2c_finish(bus, addr | 0x80, mem_addr & 0xFF, (len > 0xFF) ? 0xFF : len,
+	           i2c_ret, phase, (cbyte > 0xFF) ? 0xFF : cbyte);
+	I2C_LOCK_GIVE(bus);
+	return i2c_ret;
+}
+
+
+I2C_API i2c_err_t i2c_bus_load(i2c_bus_t *bus, const uint8_t addr,
+                                               const uint16_t mem_addr,
+                                               uint8_t *buf,
+                                               const uint16_t len,
+                                               i2c_load_t *load)
+{
+	// A failed start is passed on through load->err, so the STOP and the
+	// clock restore still happen
+	i2c_bus_load_start(bus, addr, mem_addr, buf, len, load);
+	return i2c_bus_load_finish(bus, addr, mem_addr, buf, len, load);
+}
+
+
+I2C_API uint16_t i2c_crc16(uint16_t crc, const uint8_t *buf, uint32_t len)
+{
+	while(len--) crc = i2c_crc16_byte(crc, *buf++);
+	return crc;
+}
+
+
+
+I2C_API uint32_t i2c_ckcfgr_rate(const uint16_t ckcfgr)
+{
+	uint32_t ccr = ckcfgr & I2C_CKCFGR_CCR;
+	if(ccr == 0) return 0;
+
+	// SCL Period in peripheral clocks: Standard mode is 1+1 CCR, Fast mode is
+	// 2+1 CCR, or 16+9 CCR with the DUTY bit set
+	uint32_t div = 2;
+	if(ckcfgr & I2C_CKCFGR_FS) div = (ckcfgr & I2C_CKCFGR_DUTY) ? 25 : 3;
+
+	return I2C_PCLK / (div * ccr);
+}
+
+
+I2C_API uint32_t i2c_bus_get_clk_rate(i2c_bus_t *bus)
+{
+	#ifdef I2C_SOFT_BUS
+	// Estimate from the delay loop, measure_clk_rate is not possible here
+	if(I2C_BUS_REGS(bus) == NULL)
+		return FUNCONF_SYSTEM_CORE_CLOCK / (2 * (bus->sw_delay
+		            * I2C_SOFT_LOOP_CYCLES + I2C_SOFT_OVERHEAD_CYCLES));
+	#endif
+
+	return i2c_ckcfgr_rate(I2C_BUS_REGS(bus)->CKCFGR);
+}
+
+
+/// @brief i2c_bus_measure_clk_rate(), called with the Bus Lock held
+static uint32_t i2c_measure_clk_rate_locked(i2c_bus_t *bus, const uint8_t addr)
+{
+	I2C_TypeDef *I2Cx = I2C_BUS_REGS(bus);
+	GPIO_TypeDef *port = bus->pinout->port;
+	const uint32_t scl_mask = 1 << bus->pinout->pin_scl;
+
+	#ifdef I2C_SOFT_BUS
+	if(I2Cx == NULL) return 0;
+	#endif
+
+	// Wait for the bus to become not busy
+	int32_t timeout = I2C_TIMEOUT;
+	while(I2Cx->STAR2 & I2C_STAR2_BUSY)
+		if(--timeout < 0) return 0;
+
+	// Send a START Signal and wait for it to assert
+	I2Cx->CTLR1 |= I2C_CTLR1_START;
+	if(i2c_wait(bus, I2C_EVENT_MASTER_MODE_SELECT, I2C_PHASE_START, 0) != I2C_OK)
+	{
+		I2Cx->CTLR1 |= I2C_CTLR1_STOP;
+		return 0;
+	}
+
+	// Send the Address, then time every rising edge of SCL until the ACK or
+	// NACK has been clocked
+	I2Cx->DATAR = (addr << 1) & 0xFE;
+
+	// Give up after 2ms, 9 clocks at 10KHz takes 0.9ms
+	uint32_t first = 0, last = 0, edges = 0;
+	uint32_t scl_prev = port->INDR & scl_mask;
+	const uint32_t start = I2C_TIMESTAMP();
+	while(!(I2Cx->STAR1 & (I2C_STAR1_ADDR | I2C_STAR1_AF)))
+	{
+		if(I2C_TIMESTAMP() - start > I2C_TICKS_PER_SEC / 500) break;
+
+		uint32_t scl = port->INDR & scl_mask;
+		if(scl && !scl_prev)
+		{
+			last = I2C_TIMESTAMP();
+			if(edges++ == 0) first = last;
+		}
+		scl_prev = scl;
+	}
+
+	// Clear ADDR by reading STAR2, and any NACK, then send a STOP Condition
+	(void)I2Cx->STAR2;
+	I2Cx->STAR1 &= ~I2C_STAR1_AF;
+	I2Cx->CTLR1 |= I2C_CTLR1_STOP;
+
+	// The first edge starts the first period
+	if(edges < 2 || last == first) return 0;
+	return ((edges - 1) * I2C_TICKS_PER_SEC) / (last - first);
+}
+
+
+I2C_API uint32_t i2c_bus_measure_clk_rate(i2c_bus_t *bus, const uint8_t addr)
+{
+	I2C_LOCK_TAKE(bus, 0);
+	const uint32_t ret = i2c_measure_clk_rate_locked(bus, addr);
+	I2C_LOCK_GIVE(bus);
+	return ret;
+}
+
+
+I2C_API i2c_err_t i2c_device_init(i2c_device_t *dev, i2c_bus_t *bus,
+                                                     const uint8_t addr,
+                                                     const uint32_t clk_rate)
+{
+	if(clk_rate == 0) return I2C_ERR_INVALID;
+
+	dev->bus    = bus;
+	dev->addr   = addr;
+	dev->ckcfgr = I2C_CKCFGR(clk_rate);
+	return I2C_OK;
+}
+
+
+I2C_API i2c_err_t i2c_dev_ping(const i2c_device_t *dev)
+{
+	I2C_LOCK_TAKE(dev->bus, I2C_ERR_BUSY);
+	i2c_set_ckcfgr(I2C_BUS_REGS(dev->bus), dev->ckcfgr);
+	const i2c_err_t i2c_ret = i2c_bus_ping(dev->bus, dev->addr);
+	I2C_LOCK_GIVE(dev->bus);
+	return i2c_ret;
+}
+
+
+I2C_API i2c_err_t i2c_dev_read(const i2c_device_t *dev, const uint8_t reg,
+                                                        uint8_t *buf,
+                                                        const uint8_t len)
+{
+	I2C_LOCK_TAKE(dev->bus, I2C_ERR_BUSY);
+	i2c_set_ckcfgr(I2C_BUS_REGS(dev->bus), dev->ckcfgr);
+	const i2c_err_t i2c_ret = i2c_bus_read(dev->bus, dev->addr, reg, buf, len);
+	I2C_LOCK_GIVE(dev->bus);
+	return i2c_ret;
+}
+
+
+I2C_API i2c_err_t i2c_dev_write(const i2c_device_t *dev, const uint8_t reg,
+                                                         const uint8_t *buf,
+                                                         const uint8_t len)
+{
+	I2C_LOCK_TAKE(dev->bus, I2C_ERR_BUSY);
+	i2c_set_ckcfgr(I2C_BUS_REGS(dev->bus), dev->ckcfgr);
+	const i2c_err_t i2c_ret = i2c_bus_write(dev->bus, dev->addr, reg, buf, len);
+	I2C_LOCK_GIVE(dev->bus);
+	return i2c_ret;
+}
+
+
+I2C_API i2c_err_t i2c_bus_general_call(i2c_bus_t *bus, const uint8_t cmd,
+                                                       const uint8_t *buf,
+                                                       const uint8_t len)
+{
+	// On the wire a General Call is the General Call Address followed by the
+	// command byte, which is exactly where i2c_write puts the register byte
+	return i2c_bus_write(bus, I2C_ADDR_GENERAL_CALL, cmd, buf, len);
+}
+
+
+/// @brief Writes out the pending merged burst from an Init Script, if any
+/// @param bus, addr, reg, buf, len of the pending burst. len is reset to 0
+/// @return i2c_err_t. I2C_OK on Success
+static i2c_err_t i2c_script_flush(i2c_bus_t *bus, const uint8_t addr,
+                                                  const uint8_t reg,
+                                                  const uint8_t *buf,
+                                                  uint8_t *len)
+{
+	if(*len == 0) return I2C_OK;
+
+	i2c_err_t i2c_ret = i2c_bus_write(bus, addr, reg, buf, *len);
+	*len = 0;
+	return i2c_ret;
+}
+
+I2C_API i2c_err_t i2c_bus_run_script(i2c_bus_t *bus, const uint8_t *script)
+{
+	// Writes to adjacent registers are gathered here, then sent as one burst
+	uint8_t merge_buf[I2C_SCRIPT_MERGE_MAX];
+	uint8_t merge_addr = 0, merge_reg = 0, merge_len = 0;
+
+	// Held for the whole script, so no other transaction lands between steps
+	I2C_LOCK_TAKE(bus, I2C_ERR_BUSY);
+
+	i2c_err_t i2c_ret = I2C_OK;
+	while(i2c_ret == I2C_OK)
+	{
+		const uint8_t op = *script++;
+
+		if(op == I2C_OP_WRITE || op == I2C_OP_BURST)
+		{
+			const uint8_t addr = script[0];
+			const uint8_t reg  = script[1];
+			const uint8_t len  = (op == I2C_OP_WRITE) ? 1 : script[2];
+			const uint8_t *data = script + ((op == I2C_OP_WRITE) ? 2 : 3);
+			script = data + len;
+
+			// Flush the pending burst if this step does not continue it
+			if(merge_len != 0 && (addr != merge_addr
+			   || reg != (uint8_t)(merge_reg + merge_len)
+			   || merge_len + len > I2C_SCRIPT_MERGE_MAX))
+			{
+				i2c_ret = i2c_script_flush(bus, merge_addr, merge_reg, merge_buf, &merge_len);
+				if(i2c_ret != I2C_OK) break;
+			}
+
+			// Steps too big to merge are written straight from the script
+			if(len > I2C_SCRIPT_MERGE_MAX)
+			{
+				i2c_ret = i2c_bus_write(bus, addr, reg, data, len);
+				continue;
+			}
+
+			if(merge_len == 0) {merge_addr = addr; merge_reg = reg;}
+			for(uint8_t cbyte = 0; cbyte < len; cbyte++)
+				merge_buf[merge_len++] = data[cbyte];
+			continue;
+		}
+
+		// Every other step has to see the result of the writes before it
+		i2c_ret = i2c_script_flush(bus, merge_addr, merge_reg, merge_buf, &merge_len);
+		if(i2c_ret != I2C_OK) break;
+
+		if(op == I2C_OP_END) break;
+
+		if(op == I2C_OP_DELAY)
+		{
+			Delay_Ms(script[0]);
+			script += 1;
+		}
+		else if(op == I2C_OP_POLL || op == I2C_OP_VERIFY)
+		{
+			const uint8_t addr = script[0], reg = script[1];
+			const uint8_t mask = script[2], val = script[3];
+			uint8_t timeout_ms = (op == I2C_OP_POLL) ? script[4] : 0;
+			script += (op == I2C_OP_POLL) ? 5 : 4;
+
+			uint8_t value;
+			while((i2c_ret = i2c_bus_read(bus, addr, reg, &value, 1)) == I2C_OK)
+			{
+				if((value & mask) == val) break;
+				if(timeout_ms-- == 0) {i2c_ret = I2C_ERR_VERIFY; break;}
+				Delay_Ms(1);
+			}
+		}
+		else
+		{
+			// Unknown step, the script is corrupt
+			i2c_ret = I2C_ERR_VERIFY;
+		}
+	}
+
+	I2C_LOCK_GIVE(bus);
+	return i2c_ret;
+}
+
+/// @brief Assembles a register from raw bytes, and pulls a field out of it
+/// @param raw, [field->width] bytes as read from the device
+/// @param field, Field Descriptor
+/// @return uint32_t field value, shifted down to bit 0
+static uint32_t i2c_field_extract(const uint8_t *raw, const i2c_field_t *field)
+{
+	uint32_t reg = 0;
+	for(uint8_t idx = 0; idx < field->width; idx++)
+	{
+		const uint8_t byte = (field->endian == I2C_REG_LE)
+		                     ? raw[field->width - 1 - idx] : raw[idx];
+		reg = (reg << 8) | byte;
+	}
+
+	const uint32_t mask = (field->bits >= 32) ? 0xFFFFFFFF : (1UL << field->bits) - 1;
+	return (reg >> field->shift) & mask;
+}
+
+
+I2C_API i2c_err_t i2c_field_read(const i2c_device_t *dev,
+                                 const i2c_field_t *field, uint32_t *val)
+{
+	// Hand built descriptors are not checked by I2C_REGMAP_FIELD
+	if(field->width == 0 || field->width > 4) return I2C_ERR_INVALID;
+
+	uint8_t raw[4];
+	i2c_err_t i2c_ret = i2c_dev_read(dev, field->reg, raw, field->width);
+	if(i2c_ret == I2C_OK) *val = i2c_field_extract(raw, field);
+	return i2c_ret;
+}
+
+
+I2C_API i2c_err_t i2c_field_write(const i2c_device_t *dev,
+                                  const i2c_field_t *field, const uint32_t val)
+{
+	const uint32_t mask = (field->bits >= 32) ? 0xFFFFFFFF : (1UL << field->bits) - 1;
+	uint32_t reg = 0;
+	uint8_t raw[4];
+	if(field->width == 0 || field->width > 4) return I2C_ERR_INVALID;
+
+	// Keep the bits outside the field, unless it covers the whole register
+	if(field->bits < field->width * 8)
+	{
+		i2c_err_t i2c_ret = i2c_dev_read(dev, field->reg, raw, field->width);
+		if(i2c_ret != I2C_OK) return i2c_ret;
+
+		const i2c_field_t all = {field->reg, field->width, field->endian, 0, 32};
+		reg = i2c_field_extract(raw, &all);
+	}
+
+	reg = (reg & ~(mask << field->shift)) | ((val & mask) << field->shift);
+
+	for(uint8_t idx = 0; idx < field->width; idx++)
+	{
+		const uint8_t byte = reg >> (8 * (field->width - 1 - idx));
+		raw[(field->endian == I2C_REG_LE) ? field->width - 1 - idx : idx] = byte;
+	}
+
+	return i2c_dev_write(dev, field->reg, raw, field->width);
+}
+
+
+I2C_API i2c_err_t i2c_field_read_group(const i2c_device_t *dev,
+                                       const i2c_field_t *const *fields,
+                                       const uint8_t count, uint32_t *vals)
+{
+	if(count == 0) return I2C_OK;
+
+	// Find the span of registers the fields touch. [end] is one past the
+	// last register, so it is 16 bit - a span past 0xFF can not be read
+	uint8_t first = 0xFF;
+	uint16_t end = 0x00;
+	for(uint8_t idx = 0; idx < count; idx++)
+	{
+		if(fields[idx]->width == 0 || fields[idx]->width > 4) return I2C_ERR_INVALID;
+		if(fields[idx]->reg < first) first = fields[idx]->reg;
+		if(fields[idx]->reg + fields[idx]->width > end)
+			end = fields[idx]->reg + fields[idx]->width;
+	}
+	if(end > 0x100) return I2C_ERR_INVALID;
+
+	// Too wide for one burst, read each field on its own
+	if(end - first > I2C_REGMAP_GROUP_MAX)
+	{
+		for(uint8_t idx = 0; idx < count; idx++)
+		{
+			i2c_err_t i2c_ret = i2c_field_read(dev, fields[idx], &vals[idx]);
+			if(i2c_ret != I2C_OK) return i2c_ret;
+		}
+		return I2C_OK;
+	}
+
+	uint8_t raw[I2C_REGMAP_GROUP_MAX];
+	i2c_err_t i2c_ret = i2c_dev_read(dev, first, raw, end - first);
+	if(i2c_ret != I2C_OK) return i2c_ret;
+
+	for(uint8_t idx = 0; idx < count; idx++)
+		vals[idx] = i2c_field_extract(raw + (fields[idx]->reg - first), fields[idx]);
+
+	return I2C_OK;
+}
+
+
+#ifdef I2C_FAULT
+I2C_API void i2c_fault_inject(const i2c_fault_t *fault)
+{
+	i2c_fault = *fault;
+}
+#endif
+
+
+#ifdef I2C_LOCK
+I2C_API i2c_err_t i2c_bus_lock(i2c_bus_t *bus, const uint32_t timeout_us)
+{
+	const uint8_t context = i2c_lock_context();
+	uint32_t start = 0;
+	uint8_t waited = 0;
+
+	while(1)
+	{
+		// There are no atomics on RV32EC, test and set with Interrupts off
+		const uint32_t mstatus = __get_MSTATUS();
+		__disable_irq();
+		const uint8_t owner = bus->lock_owner;
+		if(owner == 0 || owner == context)
+		{
+			bus->lock_owner = context;
+			bus->lock_depth++;
+		}
+		__set_MSTATUS(mstatus);
+		if(owner == 0 || owner == context) break;
+
+		if(!waited)
+		{
+			waited = 1;
+			start = I2C_TIMESTAMP();
+			bus->lock_stats.contended++;
+		}
+
+		if(I2C_TIMESTAMP() - start >= timeout_us * DELAY_US_TIME)
+		{
+			bus->lock_stats.failed++;
+			return I2C_ERR_BUSY;
+		}
+	}
+
+	bus->lock_stats.takes++;
+	if(waited)
+	{
+		const uint32_t wait_us = (I2C_TIMESTAMP() - start) / DELAY_US_TIME;
+		bus->lock_stats.wait_total_us += wait_us;
+		if(wait_us > bus->lock_stats.wait_max_us) bus->lock_stats.wait_max_us = wait_us;
+	}
+	return I2C_OK;
+}
+
+
+I2C_API void i2c_bus_unlock(i2c_bus_t *bus)
+{
+	// Only the owner can give the lock back
+	if(bus->lock_depth == 0 || bus->lock_owner != i2c_lock_context()) return;
+	if(--bus->lock_depth == 0) bus->lock_owner = 0;
+}
+#endif
+
+
+#ifdef I2C_TRACE
+I2C_API void i2c_trace_clear(void)
+{
+	i2c_trace.head = 0;
+}
+#endif
+
+
+/*** Transaction Queue *******************************************************/
+#ifdef I2C_QUEUE
+#ifdef I2C_STATE_DEFINE
+i2c_queue_stats_t i2c_queue_stats;
+#endif
+
+// One FIFO list per priority level
+I2C_STATE i2c_request_t *i2c_queue_head[I2C_PRIO_LEVELS];
+I2C_STATE i2c_request_t *i2c_queue_tail[I2C_PRIO_LEVELS];
+
+I2C_API i2c_err_t i2c_submit(i2c_request_t *req, const i2c_prio_t prio)
+{
+	// Submitted from the main loop and Interrupts, so claim the request and
+	// link it in with Interrupts off, leaving them as they were found
+	const uint32_t mstatus = __get_MSTATUS();
+	__disable_irq();
+	if(req->status == I2C_ERR_BUSY)
+	{
+		__set_MSTATUS(mstatus);
+		return I2C_ERR_BUSY;
+	}
+
+	req->next   = NULL;
+	req->done   = 0;
+	req->status = I2C_ERR_BUSY;
+	req->queued = I2C_TIMESTAMP();
+
+	if(i2c_queue_head[prio] == NULL) i2c_queue_head[prio] = req;
+	else i2c_queue_tail[prio]->next = req;
+	i2c_queue_tail[prio] = req;
+	__set_MSTATUS(mstatus);
+
+	return I2C_OK;
+}
+
+
+I2C_API uint8_t i2c_queue_service(void)
+{
+	// Take the oldest request of the highest priority
+	int8_t prio = I2C_PRIO_LEVELS - 1;
+	while(prio >= 0 && i2c_queue_head[prio] == NULL) --prio;
+	if(prio < 0) return 0;
+	i2c_request_t *req = i2c_queue_head[prio];
+
+	// The first chunk of a request, record how long it waited
+	const uint32_t start = I2C_TIMESTAMP();
+	if(req->done == 0 && req->retry == 0 && prio == I2C_PRIO_URGENT)
+	{
+		const uint32_t wait = start - req->queued;
+		if(wait > i2c_queue_stats.urgent_wait_max) i2c_queue_stats.urgent_wait_max = wait;
+		++i2c_queue_stats.urgent_count;
+	}
+
+	// End the chunk at the next [chunk] boundary of the register address
+	const uint8_t reg = req->reg + req->done;
+	uint8_t len = req->len - req->done;
+	if(req->chunk != 0)
+	{
+		const uint8_t to_boundary = req->chunk - (reg % req->chunk);
+		if(len > to_boundary) len = to_boundary;
+	}
+
+	i2c_err_t i2c_ret;
+	if(req->flags & I2C_REQ_WRITE)
+		i2c_ret = i2c_bus_write(req->bus, req->addr, reg, req->buf + req->done, len);
+	else
+		i2c_ret = i2c_bus_read(req->bus, req->addr, reg, req->buf + req->done, len);
+
+	const uint32_t time = I2C_TIMESTAMP() - start;
+	if(time > i2c_queue_stats.chunk_max) i2c_queue_stats.chunk_max = time;
+	++i2c_queue_stats.chunk_count;
+
+	if(i2c_ret == I2C_OK)
+	{
+		req->done += len;
+		req->retry = 0;
+		if(req->done < req->len) return 1;
+	}
+	else if(req->done != 0 && req->bus->result.phase == I2C_PHASE_ADDR &&
+	        req->bus->result.err == I2C_ERR_NACK)
+	{
+		// The device is still busy with the last chunk, retry it later
+		if(req->retry == 0) req->retry = start | 1;
+		if(start - req->retry < I2C_QUEUE_RETRY_MS * DELAY_MS_TIME) return 1;
+	}
+
+	// Finished, or failed - remove the request and report it
+	const uint32_t mstatus = __get_MSTATUS();
+	__disable_irq();
+	i2c_queue_head[prio] = req->next;
+	__set_MSTATUS(mstatus);
+
+	req->retry  = 0;
+	req->status = i2c_ret;
+	if(req->callback != NULL) req->callback(req);
+
+	for(prio = 0; prio < I2C_PRIO_LEVELS; prio++)
+		if(i2c_queue_head[prio] != NULL) return 1;
+	return 0;
+}
+#endif
+
+
+/*** Host Bridge *************************************************************/
+#ifdef I2C_BRIDGE
+#ifdef I2C_STATE_DEFINE
+volatile i2c_bridge_t i2c_bridge = {
+	.magic    = I2C_BRIDGE_MAGIC,
+	.max_ops  = I2C_BRIDGE_OPS,
+	.max_data = I2C_BRIDGE_DATA,
+};
+#endif
+
+I2C_API uint8_t i2c_bridge_poll(void)
+{
+	const uint32_t request = i2c_bridge.request;
+	if(i2c_bridge.done == request) return 0;
+
+	const uint16_t count = (i2c_bridge.count > I2C_BRIDGE_OPS) ? I2C_BRIDGE_OPS
+	                                                          : i2c_bridge.count;
+	for(uint16_t idx = 0; idx < count; idx++)
+	{
+		volatile i2c_bridge_op_t *op = &i2c_bridge.op[idx];
+
+		// Only run on a bus that exists, never fall back to another one
+		i2c_bus_t *bus = NULL;
+		if(op->bus == 0) bus = &i2c_bus1;
+		#ifdef I2C2
+		if(op->bus == 1) bus = &i2c_bus2;
+		#endif
+		if(bus == NULL) { op->err = I2C_ERR_INVALID; continue; }
+
+		// Never let the host point a transfer outside the mailbox
+		if(op->offset + op->len > I2C_BRIDGE_DATA) { op->err = I2C_ERR_OVR; continue; }
+		uint8_t *buf = (uint8_t *)&i2c_bridge.data[op->offset];
+
+		switch(op->cmd)
+		{
+			case I2C_BRIDGE_PING:
+				op->err = i2c_bus_ping(bus, op->addr);
+				break;
+			case I2C_BRIDGE_READ:
+				op->err = i2c_bus_read(bus, op->addr, op->reg, buf, op->len);
+				break;
+			case I2C_BRIDGE_WRITE:
+				op->err = i2c_bus_write(bus, op->addr, op->reg, buf, op->len);
+				break;
+			default:
+				op->err = I2C_ERR_INVALID;
+				break;
+		}
+	}
+
+	i2c_bridge.done = request;
+	return 1;
+}
+#endif
+
+
+/*** Slave Mode **************************************************************/
+#ifdef I2C_SLAVE
+// Slave Transaction States
+#define I2C_SLAVE_IDLE   0
+#define I2C_SLAVE_REG    1   // Next received byte is the register pointer
+#define I2C_SLAVE_RX     2   // Receiving data
+#define I2C_SLAVE_TX     3   // Transmitting data
+
+I2C_STATE i2c_slave_t *i2c_slave;
+
+I2C_API i2c_err_t i2c_slave_init(i2c_slave_t *slave)
+{
+	// Pins, clocks and FREQ are set up the same as in Master Mode
+	i2c_err_t i2c_ret = i2c_bus_init(&i2c_bus1, I2C_CLK_100KHZ);
+	if(i2c_ret != I2C_OK) return i2c_ret;
+
+	slave->ptr   = 0;
+	slave->state = I2C_SLAVE_IDLE;
+	i2c_slave = slave;
+
+	I2C1->OADDR1 = (slave->addr << 1) & 0xFE;
+	I2C1->CTLR1 |= I2C_CTLR1_ACK | (slave->general_call ? I2C_CTLR1_ENGC : 0);
+	I2C1->CTLR2 |= I2C_CTLR2_ITEVTEN | I2C_CTLR2_ITERREN | I2C_CTLR2_ITBUFEN;
+
+	i2c_bus_irq_priority(&i2c_bus1, I2C_IRQ_EV_PRIORITY, I2C_IRQ_ER_PRIORITY);
+	NVIC_EnableIRQ(I2C1_EV_IRQn);
+	NVIC_EnableIRQ(I2C1_ER_IRQn);
+
+	return I2C_OK;
+}
+
+
+I2C_API void i2c_slave_sleep(void)
+{
+	// Sleep, not Deep Sleep, so the I2C Peripheral stays clocked
+	NVIC->SCTLR &= ~(1 << 2);
+	__WFI();
+}
+
+
+/// @brief Ends the current slave transaction and updates the counters
+/// @param slave, Slave Handle
+/// @param entry, SysTick Count at the interrupt entry
+/// @return None
+__attribute__((always_inline))
+static inline void i2c_slave_end(i2c_slave_t *slave, const uint32_t entry)
+{
+	if(slave->state == I2C_SLAVE_RX && slave->on_write != NULL)
+		slave->on_write(slave->start, slave->count, slave->gc);
+
+	slave->state = I2C_SLAVE_IDLE;
+
+	const uint32_t awake = slave->awake + (I2C_TIMESTAMP() - entry);
+	slave->awake_last   = awake;
+	slave->awake_total += awake;
+	if(awake > slave->awake_max) slave->awake_max = awake;
+	++slave->transactions;
+}
+
+
+// The Interrupt Handlers are only defined once, with the shared state
+#ifdef I2C_STATE_DEFINE
+void I2C1_EV_IRQHandler(void) I2C_ISR;
+void I2C1_EV_IRQHandler(void)
+{
+	const uint32_t entry = I2C_TIMESTAMP();
+	i2c_slave_t *slave = i2c_slave;
+	const uint16_t star1 = I2C1->STAR1;
+
+	// Address Match, also on a Repeated START. Reading STAR2 clears ADDR
+	if(star1 & I2C_STAR1_ADDR)
+	{
+		const uint16_t star2 = I2C1->STAR2;
+		if(slave->state == I2C_SLAVE_IDLE) slave->awake = 0;
+
+		if(star2 & I2C_STAR2_TRA)
+		{
+			slave->state = I2C_SLAVE_TX;
+		} else {
+			slave->state = I2C_SLAVE_REG;
+			slave->gc    = (star2 & I2C_STAR2_GENCALL) != 0;
+			slave->count = 0;
+		}
+	}
+
+	// Byte received - the register pointer, then data
+	if(star1 & I2C_STAR1_RXNE)
+	{
+		const uint8_t data = I2C1->DATAR;
+		if(slave->state == I2C_SLAVE_REG)
+		{
+			slave->ptr   = (data < slave->size) ? data : 0;
+			slave->start = slave->ptr;
+			slave->state = I2C_SLAVE_RX;
+		} else if(slave->size != 0) {
+			slave->regs[slave->ptr] = data;
+			if(++slave->ptr >= slave->size) slave->ptr = 0;
+			++slave->count;
+		}
+	}
+
+	// Master wants the next byte. An empty map reads as 0xFF
+	if((star1 & I2C_STAR1_TXE) && slave->state == I2C_SLAVE_TX)
+	{
+		if(slave->size == 0)
+		{
+			I2C1->DATAR = 0xFF;
+		} else {
+			I2C1->DATAR = slave->regs[slave->ptr];
+			if(++slave->ptr >= slave->size) slave->ptr = 0;
+		}
+	}
+
+	// STOP after a write. Cleared by reading STAR1, then writing CTLR1
+	if(star1 & I2C_STAR1_STOPF)
+	{
+		I2C1->CTLR1 |= I2C_CTLR1_PE;
+		i2c_slave_end(slave, entry);
+		return;
+	}
+
+	slave->awake += I2C_TIMESTAMP() - entry;
+}
+
+
+void I2C1_ER_IRQHandler(void) I2C_ISR;
+void I2C1_ER_IRQHandler(void)
+{
+	const uint32_t entry = I2C_TIMESTAMP();
+	i2c_slave_t *slave = i2c_slave;
+	const uint16_t star1 = I2C1->STAR1;
+
+	// The master NACKs the last byte it reads, which ends a read. The byte
+	// already loaded into DATAR was never sent, so step the pointer back
+	if((star1 & I2C_STAR1_AF) && slave->state == I2C_SLAVE_TX && slave->size != 0)
+		slave->ptr = (slave->ptr == 0) ? slave->size - 1 : slave->ptr - 1;
+
+	I2C1->STAR1 = star1 & ~(I2C_STAR1_AF | I2C_STAR1_BERR |
+	                        I2C_STAR1_ARLO | I2C_STAR1_OVR);
+	if(slave->state != I2C_SLAVE_IDLE) i2c_slave_end(slave, entry);
+}
+#endif
+#endif
+
+
+/*** Default Bus Functions ***************************************************/
+I2C_API i2c_err_t i2c_init(const uint32_t clk_rate)
+{
+	return i2c_bus_init(&i2c_bus1, clk_rate);
+}
+
+
+I2C_API i2c_err_t i2c_ping(const uint8_t addr)
+{
+	return i2c_bus_ping(&i2c_bus1, addr);
+}
+
+
+I2C_API void i2c_scan(void (*callback)(const uint8_t))
+{
+	i2c_bus_scan(&i2c_bus1, callback);
+}
+
+
+I2C_API_HOT i2c_err_t i2c_read(const uint8_t addr,		const uint8_t reg,
+											uint8_t *buf,
+											const uint8_t len)
+{
+	return i2c_bus_read(&i2c_bus1, addr, reg, buf, len);
+}
+
+
+I2C_API_HOT i2c_err_t i2c_write(const uint8_t addr,		const uint8_t reg,
+											const uint8_t *buf,
+											const uint8_t len)
+{
+	return i2c_bus_write(&i2c_bus1, addr, reg, buf, len);
+}
+
+
+I2C_API uint32_t i2c_get_clk_rate(void)
+{
+	return i2c_bus_get_clk_rate(&i2c_bus1);
+}
+
+
+I2C_API uint32_t i2c_measure_clk_rate(const uint8_t addr)
+{
+	return i2c_bus_measure_clk_rate(&i2c_bus1, addr);
+}
+
+
+I2C_API i2c_err_t i2c_general_call(const uint8_t cmd, const uint8_t *buf,
+                                                      const uint8_t len)
+{
+	return i2c_bus_general_call(&i2c_bus1, cmd, buf, len);
+}
+
+
+I2C_API i2c_err_t i2c_run_script(const uint8_t *script)
+{
+	return i2c_bus_run_script(&i2c_bus1, script);
+}
+
+
+I2C_API i2c_err_t i2c_remap(const i2c_pinout_t *pinout)
+{
+	return i2c_bus_remap(&i2c_bus1, pinout);
+}
+
+
+I2C_API i2c_err_t i2c_set_clk_rate(const uint32_t clk_rate)
+{
+	return i2c_bus_set_clk_rate(&i2c_bus1, clk_rate);
+}
+
+
+I2C_API i2c_err_t i2c_recover(void)
+{
+	return i2c_bus_recover(&i2c_bus1);
+}
+
+
+I2C_API void i2c_save(i2c_state_t *state)
+{
+	i2c_bus_save(&i2c_bus1, state);
+}
+
+
+I2C_API void i2c_restore(const i2c_state_t *state)
+{
+	i2c_bus_restore(&i2c_bus1, state);
+}
+
+
+I2C_API i2c_err_t i2c_check_bus(i2c_health_t *health)
+{
+	return i2c_bus_check(&i2c_bus1, health);
+}
+
+
+I2C_API i2c_err_t i2c_load(const uint8_t addr, const uint16_t mem_addr,
+                           uint8_t *buf, const uint16_t len, i2c_load_t *load)
+{
+	return i2c_bus_load(&i2c_bus1, addr, mem_addr, buf, len, load);
+}
+
+
+#endif
+#endif
@@ -42,6 +42,75 @@
 //#define I2C_PINOUT_ALT_1
 //#define I2C_PINOUT_ALT_2
 
+// Uncomment to allow bit-banged busses on any GPIO (see i2c_bus_t)
+//#define I2C_SOFT_BUS
+
+// Uncomment to log every transaction into a RAM ring buffer (see i2c_trace)
+//#define I2C_TRACE
+
+// Uncomment to also log how long each phase of a transaction took, so
+// minichlink can rebuild the SCL/SDA waveform. Needs I2C_TRACE
+//#define I2C_TRACE_TIMING
+
+// Uncomment to allow faults to be injected into transactions, to measure how
+// long the application takes to recover from them (see i2c_fault_t)
+//#define I2C_FAULT
+
+// Uncomment to let minichlink run bus transfers through a RAM mailbox, for
+// i2cdetect/get/set/dump style access from the host (see i2c_bridge_t)
+//#define I2C_BRIDGE
+
+// Uncomment to enable the prioritised Transaction Queue (see i2c_request_t)
+//#define I2C_QUEUE
+
+// Uncomment to let lib_i2c use DMA for Bulk Loads. The RX Channel is claimed
+// through ch32v003_DMA.h in toolkit/extralibs by the first load, define
+// CH32V003_DMA_IMPLEMENTATION in one file of the project
+//#define I2C_DMA
+
+// Uncomment to add a Bus Lock, taken by every transaction so the main loop
+// and Interrupts can share a bus (see i2c_bus_lock)
+//#define I2C_LOCK
+
+// Uncomment to enable the interrupt driven Slave Mode on I2C1 (see
+// i2c_slave_t). This defines I2C1_EV_IRQHandler and I2C1_ER_IRQHandler
+//#define I2C_SLAVE
+
+// Uncomment to run the I2C Interrupt Handlers from RAM instead of flash. This
+// skips the flash wait states on entry, so DATAR is serviced soon enough to
+// avoid clock stretching at 1MHz. Uses the .ramfunc section in ch32v003fun.ld
+//#define I2C_ISR_IN_RAM
+
+// Uncomment for the bootloader sized profile. The optional features are
+// forced off, and i2c_load() is a plain polled read at the current clock.
+// Build with -ffunction-sections and --gc-sections so only the functions used
+// are linked. See bootloader/
+//#define I2C_MINIMAL
+
+// Uncomment to build the library header-only, with every function static
+// inline, and the read and write calls forced inline, so calls on the
+// default bus with constant addresses, registers and lengths can fold into
+// straight-line register accesses. Best for a few hot call sites with
+// -flto. Define I2C_IMPLEMENTATION in one file of the project, before
+// including lib_i2c.h - it holds the shared state and Interrupt Handlers
+//#define I2C_INLINE
+
+#ifdef I2C_MINIMAL
+	#undef I2C_SOFT_BUS
+	#undef I2C_TRACE
+	#undef I2C_QUEUE
+	#undef I2C_SLAVE
+	#undef I2C_ISR_IN_RAM
+	#undef I2C_BRIDGE
+	#undef I2C_DMA
+	#undef I2C_LOCK
+	#undef I2C_FAULT
+#endif
+
+#ifndef I2C_TRACE
+	#undef I2C_TRACE_TIMING
+#endif
+
 /*** Hardware Definitions ****************************************************/
 // Predefined Clock Speeds
 #define I2C_CLK_10KHZ  10000
@@ -53,10 +122,76 @@
 #define I2C_CLK_750KHZ 750000
 #define I2C_CLK_1MHZ   1000000
 
+// General Call Address, and the Command Bytes defined by the I2C Spec.
+// Every device that supports General Call ACKs and acts on the same message
+#define I2C_ADDR_GENERAL_CALL 0x00
+#define I2C_GC_RESET          0x06  // Reset and latch programmable address
+#define I2C_GC_LATCH_ADDR     0x04  // Latch programmable address, no reset
+
 // Hardware CLK Prerate and timeout
 #define I2C_PRERATE 1000000
 #define I2C_TIMEOUT 2000
 
+// Clock feeding the I2C Peripherals (PCLK1) in Hz, which FREQ and CCR count.
+// ch32v003fun runs APB1 at HCLK/2 on the CH32V10x/20x/30x when the PLL is
+// used, otherwise at HCLK. Predefine it if the clock tree is set up another way
+#ifndef I2C_PCLK
+	#if !defined(CH32V003) && !defined(CH32X03x) && \
+	    defined(FUNCONF_USE_PLL) && FUNCONF_USE_PLL
+		#define I2C_PCLK (FUNCONF_SYSTEM_CORE_CLOCK / 2)
+	#else
+		#define I2C_PCLK FUNCONF_SYSTEM_CORE_CLOCK
+	#endif
+#endif
+
+// PFIC Priority of the I2C Event and Error Interrupts, used when the library
+// enables them. Lower values are served first. On the CH32V003 bit 7 is the
+// preemption level and bit 6 the sub-priority, eg 0x00 preempts other
+// interrupts at 0x80, such as a ws2812b DMA handler left at the default
+#ifndef I2C_IRQ_EV_PRIORITY
+#define I2C_IRQ_EV_PRIORITY 0x80
+#endif
+#ifndef I2C_IRQ_ER_PRIORITY
+#define I2C_IRQ_ER_PRIORITY 0x80
+#endif
+
+// Attributes for I2C Interrupt Handlers, and functions they call that must
+// not be inlined. I2C_ISR can be predefined, eg for a different interrupt
+// attribute
+#ifdef I2C_ISR_IN_RAM
+	#define I2C_RAMFUNC __attribute__((section(".ramfunc"), noinline))
+#else
+	#define I2C_RAMFUNC
+#endif
+#ifndef I2C_ISR
+	#define I2C_ISR __attribute__((interrupt)) I2C_RAMFUNC
+#endif
+
+// Number of rise time samples averaged by i2c_check_bus(), and how long to
+// wait for a released line to rise before calling it stuck
+#define I2C_RISE_SAMPLES    8
+#define I2C_RISE_TIMEOUT_US 100
+
+// Calculates the CKCFGR Register value for a clock rate in Hz.
+// Standard mode up to 100KHz. Above that, Fast mode with whichever of the
+// 2:1 or 16:9 Duty Cycles gets closest. CCR is rounded up, so the bus never
+// runs faster than requested. Constant clock rates are calculated at compile
+// time. i2c_ckcfgr_rate() reports the rate a CKCFGR value actually gives.
+// A clk_rate of 0 gives 0, which is never written to the peripheral
+#define I2C_CCR_DIV(clk_rate, div) \
+	((I2C_PCLK + ((div) * (clk_rate)) - 1) / ((div) * (clk_rate)))
+
+#define I2C_CKCFGR(clk_rate) ((clk_rate) == 0 ? 0 : (clk_rate) <= 100000 \
+	? (I2C_CCR_DIV(clk_rate, 2) & I2C_CKCFGR_CCR) \
+	: (3 * I2C_CCR_DIV(clk_rate, 3) > 25 * I2C_CCR_DIV(clk_rate, 25)) \
+		? ((I2C_CCR_DIV(clk_rate, 25) & I2C_CKCFGR_CCR) \
+		   | I2C_CKCFGR_FS | I2C_CKCFGR_DUTY) \
+		: ((I2C_CCR_DIV(clk_rate, 3) & I2C_CKCFGR_CCR) | I2C_CKCFGR_FS))
+
+#if defined(CH32V003)
+// Bits in AFIO_PCFR1 which select the I2C1 Pinout
+#define I2C_AFIO_MASK	((uint32_t)0x04400002)
+
 // Default Pinout
 #ifdef I2C_PINOUT_DEFAULT
 	#define I2C_AFIO_REG	((uint32_t)0x00000000)
@@ -84,6 +219,45 @@
 	#define I2C_PIN_SDA 	6
 #endif
 
+#else
+// CH32V10x, CH32V20x and CH32V30x. UNTESTED
+#define I2C_AFIO_MASK	((uint32_t)0x00000002)
+
+// I2C1 Default Pinout
+#ifdef I2C_PINOUT_DEFAULT
+	#define I2C_AFIO_REG	((uint32_t)0x00000000)
+	#define I2C_PORT_RCC	RCC_APB2Periph_GPIOB
+	#define I2C_PORT		GPIOB
+	#define I2C_PIN_SCL 	6
+	#define I2C_PIN_SDA 	7
+#endif
+
+// I2C1 Remapped Pinout
+#ifdef I2C_PINOUT_ALT_1
+	#define I2C_AFIO_REG	((uint32_t)0x00000002)
+	#define I2C_PORT_RCC	RCC_APB2Periph_GPIOB
+	#define I2C_PORT		GPIOB
+	#define I2C_PIN_SCL 	8
+	#define I2C_PIN_SDA 	9
+#endif
+
+#ifdef I2C_PINOUT_ALT_2
+	#error "I2C_PINOUT_ALT_2 only exists on the CH32V003"
+#endif
+
+// I2C2 Pinout
+#define I2C2_PORT_RCC	RCC_APB2Periph_GPIOB
+#define I2C2_PORT		GPIOB
+#define I2C2_PIN_SCL	10
+#define I2C2_PIN_SDA	11
+#endif
+
+// DMA1 Channels wired to the TX and RX requests of each peripheral
+#define I2C1_DMA_TX 6
+#define I2C1_DMA_RX 7
+#define I2C2_DMA_TX 4
+#define I2C2_DMA_RX 5
+
 // Error Code Definitons
 typedef enum {
 	I2C_OK	  = 0,  // No Error. All OK
@@ -92,31 +266,585 @@ typedef enum {
 	I2C_ERR_ARLO,	 // Arbitration Lost
 	I2C_ERR_OVR,	  // Overun/underrun condition
 	I2C_ERR_BUSY,	 // Bus was busy and timed out
+	I2C_ERR_VERIFY,	 // Script read-back or Load CRC did not match
+	I2C_ERR_INVALID, // Invalid argument, eg a clock rate of 0
 } i2c_err_t;
 
+// Transaction Phase Definitions - the point a transaction got to before it
+// finished, or failed
+typedef enum {
+	I2C_PHASE_IDLE = 0,  // Waiting for the bus to become free
+	I2C_PHASE_START,     // Sending the START Condition
+	I2C_PHASE_ADDR,      // Sending the Device Address
+	I2C_PHASE_REG,       // Sending the Register Byte
+	I2C_PHASE_RESTART,   // Sending the Repeated START and Read Address
+	I2C_PHASE_DATA,      // Transferring Data Bytes
+	I2C_PHASE_DONE,      // Transaction Completed
+} i2c_phase_t;
+
+// Extended Result of the last transaction on a bus, see i2c_bus_t.result.
+// A failed write can be resumed from the first byte not known to be ACKed:
+//   const i2c_result_t *res = &i2c_bus1.result;
+//   if(res->phase == I2C_PHASE_DATA)
+//       i2c_write(addr, reg + res->bytes, buf + res->bytes, len - res->bytes);
+typedef struct {
+	i2c_err_t   err;     // Same as the returned error
+	i2c_phase_t phase;   // Phase reached, I2C_PHASE_DONE on success
+	uint8_t     bytes;   // Data bytes completed. Reads: received, Writes: ACKed
+	uint16_t    star1;   // STAR1 and STAR2 at the point of failure, or at the
+	uint16_t    star2;   // end on success. 0 on a bit-banged bus
+} i2c_result_t;
+
+
+// Bus Pinout - the GPIO Port, Pins and AFIO Remap bits a bus uses
+typedef struct {
+	GPIO_TypeDef *port;    // GPIO Port SCL and SDA are on
+	uint32_t port_rcc;     // RCC_APB2Periph_GPIOx bit for the Port
+	uint32_t afio_mask;    // AFIO_PCFR1 bits that select this busses pins
+	uint32_t afio_reg;     // AFIO_PCFR1 bits to set
+	uint8_t  pin_scl;
+	uint8_t  pin_sda;
+} i2c_pinout_t;
+
+#ifdef I2C_LOCK
+// Time a transaction waits for a locked bus before failing with
+// I2C_ERR_BUSY. Transactions from an Interrupt never wait, the holder can
+// not run until they return
+#ifndef I2C_LOCK_TIMEOUT_US
+#define I2C_LOCK_TIMEOUT_US 5000
+#endif
+
+// Bus Lock Contention Counters, see i2c_bus_t.lock_stats
+typedef struct {
+	uint32_t takes;          // Times the lock was taken, including nested
+	uint32_t contended;      // Takes that found the bus locked by another
+	uint32_t failed;         // Takes that gave up, the bus stayed locked
+	uint32_t wait_max_us;    // Longest wait for the lock
+	uint32_t wait_total_us;  // Total time spent waiting for the lock
+} i2c_lock_stats_t;
+#endif
+
+// Bus Handle - one per hardware I2C Peripheral. i2c_bus1 is used by all the
+// functions that do not take a bus. i2c_bus2 exists on parts with I2C2.
+// Transfers are polled, and return once they have finished, so two busses
+// only move data at the same time through i2c_bus_load_start() with I2C_DMA.
+// With I2C_SOFT_BUS defined, a bus with regs = NULL is bit-banged on the
+// pinout instead, using the same API. Clock stretching is supported.
+// Example:
+//   static const i2c_pinout_t sw_pins =
+//       I2C_SOFT_PINOUT(GPIOD, RCC_APB2Periph_GPIOD, 3, 4);
+//   i2c_bus_t sw_bus = I2C_SOFT_BUS_INIT(&sw_pins);
+//   i2c_bus_init(&sw_bus, I2C_CLK_400KHZ);
+typedef struct {
+	I2C_TypeDef *regs;             // I2C1 or I2C2, NULL for a bit-banged bus
+	const i2c_pinout_t *pinout;    // Pins used by the bus
+	uint16_t sw_delay;             // Bit-banged bus: delay loops per half clock
+	i2c_result_t result;           // Result of the last transaction
+
+	#ifdef I2C_LOCK
+	volatile uint8_t lock_owner;   // Context holding the lock, 0 when free
+	uint8_t lock_depth;            // Nested takes by the owner
+	i2c_lock_stats_t lock_stats;
+	#endif
+} i2c_bus_t;
+
+#ifdef I2C_SOFT_BUS
+// Bit-Banged Pinout, any two pins on the same port
+#define I2C_SOFT_PINOUT(gpio, gpio_rcc, scl, sda) { \
+	.port = (gpio), .port_rcc = (gpio_rcc), .afio_mask = 0, .afio_reg = 0, \
+	.pin_scl = (scl), .pin_sda = (sda)}
+
+#define I2C_SOFT_BUS_INIT(pinout) {.regs = NULL, .pinout = (pinout)}
+
+// CPU Cycles taken by one iteration of the bit-bang delay loop, and the fixed
+// cycles spent on pin access per half clock. Tune if the rate is off
+#ifndef I2C_SOFT_LOOP_CYCLES
+#define I2C_SOFT_LOOP_CYCLES 4
+#endif
+#ifndef I2C_SOFT_OVERHEAD_CYCLES
+#define I2C_SOFT_OVERHEAD_CYCLES 16
+#endif
+#endif
+
+extern i2c_bus_t i2c_bus1;
+#ifdef I2C2
+extern i2c_bus_t i2c_bus2;
+#endif
+
+// Saved Peripheral setup. Restoring it after Standby skips the peripheral
+// reset and re-init, so the lines do not glitch and need no settling delay
+typedef struct {
+	uint16_t ctlr1;    // PE, ACK, ENGC etc
+	uint16_t ctlr2;    // FREQ and Interrupt Enables
+	uint16_t oaddr1;   // Own Address
+	uint16_t ckcfgr;   // Clock Setup
+} i2c_state_t;
+
+// Bus Line Health, filled in by i2c_check_bus()
+typedef struct {
+	uint8_t  scl_stuck;      // 1 if SCL is held low
+	uint8_t  sda_stuck;      // 1 if SDA is held low
+	uint16_t scl_rise_ns;    // Released to logic High time, 0xFFFF if it never rose
+	uint16_t sda_rise_ns;
+	uint16_t resolution_ns;  // Rise time step, one SysTick Count. 166ns at the
+	                         // default 48MHz HCLK / 8
+	uint32_t max_clk_rate;   // Highest I2C_CLK_* the lines can manage, 0 if none
+} i2c_health_t;
+
+// Bulk Load setup and report, for i2c_load(). Loads a range of an EEPROM or
+// FRAM into RAM in one sequential read, with a CRC-16/CCITT of the data
+// computed as the bytes arrive. With I2C_MINIMAL only the data and [bytes]
+// are filled in, verify and the other reports are left out. Example:
+//   i2c_load_t load = {.addr_bytes = 2, .verify = 1, .crc_expect = 0x29B1};
+//   i2c_load(0x50, 0x0100, table, sizeof(table), &load);
+typedef struct {
+	uint32_t clk_rate;     // SCL Frequency for the load, 0 for the fastest the
+	                       // lines allow, from i2c_check_bus(). Ignored with
+	                       // I2C_MINIMAL, which loads at the i2c_init() rate
+	uint8_t  addr_bytes;   // Memory Address width, 1 (24C01 - 24C16) or 2
+	uint8_t  verify;       // 1 to fail with I2C_ERR_VERIFY if crc != crc_expect
+	uint16_t crc_expect;
+	uint16_t crc;          // Out: CRC-16/CCITT of the loaded bytes
+	uint16_t bytes;        // Out: Bytes loaded
+	uint32_t used_rate;    // Out: Clock rate the load ran at
+	uint32_t time_us;      // Out: Time from START to STOP
+
+	// Internal, carried from i2c_bus_load_start() to i2c_bus_load_finish()
+	i2c_err_t   err;
+	i2c_phase_t phase;
+	uint32_t    start;
+	uint16_t    ckcfgr;
+	#ifdef I2C_LOCK
+	uint8_t     locked;
+	#endif
+} i2c_load_t;
+
+// CRC-16/CCITT-FALSE start value, for i2c_crc16()
+#define I2C_CRC16_INIT 0xFFFF
+
+// Predefined Hardware Pinouts, for selecting or switching pins at runtime
+// with i2c_remap(). One binary can then serve several board revisions, or
+// one bus can reach two groups of devices with the same address
+extern const i2c_pinout_t i2c_pinout_default;
+extern const i2c_pinout_t i2c_pinout_alt_1;
+#if defined(CH32V003)
+extern const i2c_pinout_t i2c_pinout_alt_2;
+#endif
+
+// Device Handle. Each device on the bus carries its own precomputed clock
+// setting, so fast and slow devices can share the bus without every
+// transaction running at the slowest devices rate. A clk_rate of 0 leaves
+// the bus at whatever rate it is running
+// Example:
+//   static const i2c_device_t fram   = I2C_DEVICE(0x50, I2C_CLK_1MHZ);
+//   static const i2c_device_t sensor = I2C_DEVICE(0x48, I2C_CLK_100KHZ);
+//   static const i2c_device_t imu    = I2C_BUS_DEVICE(&i2c_bus2, 0x68, I2C_CLK_400KHZ);
+typedef struct {
+	i2c_bus_t *bus;   // Bus the device is on
+	uint8_t  addr;    // 7-Bit Device Address
+	uint16_t ckcfgr;  // CKCFGR Register value, see I2C_CKCFGR()
+} i2c_device_t;
+
+#define I2C_BUS_DEVICE(bus, addr, clk_rate) {(bus), (addr), I2C_CKCFGR(clk_rate)}
+#define I2C_DEVICE(addr, clk_rate) I2C_BUS_DEVICE(&i2c_bus1, addr, clk_rate)
+
+
+/*** Transaction Trace *******************************************************/
+#ifdef I2C_TRACE
+// Number of records kept in the trace ring. MUST be a power of 2. With
+// I2C_TRACE_TIMING each record takes 36 bytes of RAM
+#ifndef I2C_TRACE_DEPTH
+#define I2C_TRACE_DEPTH 32
+#endif
+
+// Marks the start of the trace ring in RAM, so the host can find it ("I2CT")
+#define I2C_TRACE_MAGIC 0x54433249
+
+// Single Trace Record, 8 Bytes, or 36 with I2C_TRACE_TIMING. The layout is
+// shared with minichlink
+typedef struct {
+	uint32_t timestamp;  // SysTick Count when the transaction finished
+	uint8_t  addr;       // 7-Bit Device Address. Bit 7 is set for reads
+	uint8_t  reg;        // Register Byte
+	uint8_t  len;        // Number of data bytes requested
+	uint8_t  status;     // i2c_err_t in the upper nibble, i2c_phase_t lower
+	#ifdef I2C_TRACE_TIMING
+	uint16_t ckcfgr;     // CKCFGR the transaction ran at, 0 on a Software Bus
+	uint8_t  pclk_mhz;   // CTLR2 FREQ, the clock CKCFGR counts
+	uint8_t  bytes;      // Data bytes completed, 0xFF at most
+	uint32_t ticks[I2C_PHASE_DONE];  // SysTick Counts spent in each phase,
+	                                 // 0 if not reached
+	#endif
+} i2c_trace_rec_t;
+
+// Trace Ring. head counts every record ever written, the newest record is
+// at rec[(head - 1) % depth]
+typedef struct {
+	uint32_t magic;         // I2C_TRACE_MAGIC
+	uint16_t depth;         // I2C_TRACE_DEPTH
+	uint8_t  ticks_per_us;  // SysTick Counts per microsecond
+	uint8_t  rec_size;      // sizeof(i2c_trace_rec_t)
+	uint32_t head;          // Total number of records written
+	i2c_trace_rec_t rec[I2C_TRACE_DEPTH];
+} i2c_trace_t;
+
+extern volatile i2c_trace_t i2c_trace;
+#endif
+
+
+/*** Fault Injection *********************************************************/
+#ifdef I2C_FAULT
+// A fault makes a hardware bus transaction fail at a chosen phase and data
+// byte, as if the fault really happened. The transaction then takes its real
+// error path (STOP, result, trace), and the application its retry path.
+// SCL_HELD and SDA_STUCK stall the register wait of that phase, so it runs
+// to its timeout. The bus then stays held, every transaction timing out,
+// until i2c_recover() is called.
+// From the first injected failure to the next transaction that succeeds on
+// any bus, every failed transaction counts as lost, and the time taken is
+// the recovery latency for that fault type.
+// Example - NACK the address of the next 5 transactions:
+//   i2c_fault_inject(&(i2c_fault_t){I2C_FAULT_NACK, I2C_PHASE_ADDR, 0, 5});
+typedef enum {
+	I2C_FAULT_NONE = 0,
+	I2C_FAULT_NACK,       // Device does not ACK
+	I2C_FAULT_ARLO,       // Arbitration lost to another master
+	I2C_FAULT_BERR,       // Misplaced START or STOP
+	I2C_FAULT_SCL_HELD,   // Device holds SCL, the phase times out. Held
+	                      // lines must come after the error faults
+	I2C_FAULT_SDA_STUCK,  // SDA held low, the bus never goes idle. Use with
+	                      // I2C_PHASE_IDLE
+	I2C_FAULT_TYPES,
+} i2c_fault_type_t;
+
+// Armed Fault
+typedef struct {
+	i2c_fault_type_t type;
+	i2c_phase_t phase;    // Phase to fail in
+	uint8_t byte;         // Data byte to fail on, for I2C_PHASE_DATA
+	uint8_t repeat;       // Number of transactions to fail
+} i2c_fault_t;
+
+// Recovery figures for each fault type, see i2c_fault_stats
+typedef struct {
+	uint32_t injected;         // Failures injected
+	uint32_t lost;             // Transactions failed until recovery
+	uint32_t recoveries;       // Times the bus recovered
+	uint32_t recover_us_max;   // Longest time from first failure to success
+	uint32_t recover_us_total;
+} i2c_fault_stats_t;
+
+extern i2c_fault_t i2c_fault;
+extern i2c_fault_stats_t i2c_fault_stats[I2C_FAULT_TYPES];
+#endif
+
+
+/*** Host Bridge *************************************************************/
+#ifdef I2C_BRIDGE
+// minichlink writes a batch of operations and their write data into
+// i2c_bridge while the core is halted, then bumps [request]. The next
+// i2c_bridge_poll() runs the whole batch and sets [done] to match, leaving
+// read data and each result in place. Batching keeps a scan or dump to a few
+// debug link round trips.
+#ifndef I2C_BRIDGE_OPS
+#define I2C_BRIDGE_OPS 16
+#endif
+#ifndef I2C_BRIDGE_DATA
+#define I2C_BRIDGE_DATA 256
+#endif
+
+// Marks the mailbox in RAM, so the host can find it ("I2CM")
+#define I2C_BRIDGE_MAGIC 0x4D433249
+
+typedef enum {
+	I2C_BRIDGE_PING = 0,
+	I2C_BRIDGE_READ,
+	I2C_BRIDGE_WRITE,
+} i2c_bridge_cmd_t;
+
+// Single Operation, 8 Bytes. The layout is shared with minichlink
+typedef struct {
+	uint8_t  cmd;     // i2c_bridge_cmd_t
+	uint8_t  bus;     // 0 for i2c_bus1, 1 for i2c_bus2. A bus the part does
+	                  // not have, or an unknown cmd, fails with I2C_ERR_INVALID
+	uint8_t  addr;    // 7-Bit Device Address
+	uint8_t  reg;     // Register Byte
+	uint8_t  len;     // Data bytes to read or write
+	uint8_t  err;     // i2c_err_t, written by the target
+	uint16_t offset;  // Where the data is in data[]
+} i2c_bridge_op_t;
+
+// Mailbox. The layout is shared with minichlink
+typedef struct {
+	uint32_t magic;     // I2C_BRIDGE_MAGIC
+	uint16_t max_ops;   // I2C_BRIDGE_OPS
+	uint16_t max_data;  // I2C_BRIDGE_DATA
+	uint32_t request;   // Bumped by the host to start a batch
+	uint32_t done;      // Set to [request] when the batch has run
+	uint16_t count;     // Operations in the batch
+	uint16_t reserved;
+	i2c_bridge_op_t op[I2C_BRIDGE_OPS];
+	uint8_t  data[I2C_BRIDGE_DATA];
+} i2c_bridge_t;
+
+extern volatile i2c_bridge_t i2c_bridge;
+#endif
+
+
+/*** Init Scripts ************************************************************/
+// Device bring-up sequences can be stored as a const byte table in flash and
+// run with i2c_run_script(), instead of a chain of i2c_write calls.
+// Consecutive WRITE/BURST steps to the same device and adjacent registers are
+// merged into a single burst write. Put an I2C_SCRIPT_DELAY(0) between writes
+// that must not be merged (eg devices without register auto-increment)
+// Example:
+//   static const uint8_t ds3231_init[] = {
+//       I2C_SCRIPT_WRITE(0x68, 0x0E, 0x1C),
+//       I2C_SCRIPT_WRITE(0x68, 0x0F, 0x00),   // Merged with 0x0E
+//       I2C_SCRIPT_VERIFY(0x68, 0x0F, 0x80, 0x00),
+//       I2C_SCRIPT_END
+//   };
+typedef enum {
+	I2C_OP_END = 0,  // End of the script
+	I2C_OP_WRITE,    // addr, reg, value
+	I2C_OP_BURST,    // addr, reg, len, [len] bytes of data
+	I2C_OP_DELAY,    // ms
+	I2C_OP_POLL,     // addr, reg, mask, value, timeout ms
+	I2C_OP_VERIFY,   // addr, reg, mask, value
+} i2c_script_op_t;
+
+// Maximum number of bytes merged into a single burst write
+#ifndef I2C_SCRIPT_MERGE_MAX
+#define I2C_SCRIPT_MERGE_MAX 16
+#endif
+
+#define I2C_SCRIPT_END                   I2C_OP_END
+#define I2C_SCRIPT_WRITE(addr, reg, val) I2C_OP_WRITE, (addr), (reg), (val)
+// Must be followed by [len] data bytes
+#define I2C_SCRIPT_BURST(addr, reg, len) I2C_OP_BURST, (addr), (reg), (len)
+#define I2C_SCRIPT_DELAY(ms)             I2C_OP_DELAY, (ms)
+// Re-reads [reg] every 1ms until (value & mask) == val, or timeout_ms passes
+#define I2C_SCRIPT_POLL(addr, reg, mask, val, timeout_ms) \
+	I2C_OP_POLL, (addr), (reg), (mask), (val), (timeout_ms)
+// Reads [reg] once, fails the script if (value & mask) != val
+#define I2C_SCRIPT_VERIFY(addr, reg, mask, val) \
+	I2C_OP_VERIFY, (addr), (reg), (mask), (val)
+
+
+/*** Register Maps ***********************************************************/
+// A devices registers and bitfields can be described once as X-Macro tables,
+// and I2C_REGMAP() generates a field descriptor plus a uint32_t getter and
+// setter for every field. Several fields can be fetched with i2c_field_read_group(),
+// which reads every register they touch in one auto-increment burst.
+// Example:
+/*
+   #define DS3231_REGS(REG) \
+       REG(DS3231, SECONDS, 0x00, 1, I2C_REG_BE) \
+       REG(DS3231, MINUTES, 0x01, 1, I2C_REG_BE) \
+       REG(DS3231, TEMP,    0x11, 2, I2C_REG_BE)
+   #define DS3231_FIELDS(FIELD) \
+       FIELD(DS3231, SECONDS, SEC_UNITS, 0, 4) \
+       FIELD(DS3231, SECONDS, SEC_TENS,  4, 3) \
+       FIELD(DS3231, MINUTES, MIN_UNITS, 0, 4) \
+       FIELD(DS3231, TEMP,    TEMP_Q2,   6, 10)
+   I2C_REGMAP(DS3231_REGS, DS3231_FIELDS)
+
+   uint32_t units;
+   DS3231_get_SEC_UNITS(&rtc, &units);
+   DS3231_set_MIN_UNITS(&rtc, 5);     // Read-Modify-Write of MINUTES
+   static const i2c_field_t *const now[] = {&DS3231_SEC_UNITS, &DS3231_MIN_UNITS};
+   uint32_t vals[2];
+   i2c_field_read_group(&rtc, now, 2, vals);   // One 2 byte read
+*/
+
+#define I2C_REG_BE 0   // Multi-byte register, Most Significant Byte first
+#define I2C_REG_LE 1   // Least Significant Byte first
+
+// Largest register span i2c_field_read_group() reads in one burst. Wider
+// groups fall back to a read per field
+#ifndef I2C_REGMAP_GROUP_MAX
+#define I2C_REGMAP_GROUP_MAX 16
+#endif
+
+// Field Descriptor, a run of bits within a 1 - 4 byte register
+typedef struct {
+	uint8_t reg;      // Register Address
+	uint8_t width;    // Register width in bytes
+	uint8_t endian;   // I2C_REG_BE or I2C_REG_LE
+	uint8_t shift;    // Lowest bit of the field
+	uint8_t bits;     // Field width in bits
+} i2c_field_t;
+
+// Generates [dev]_REG_[name], [dev]_WIDTH_[name] and [dev]_ENDIAN_[name]
+#define I2C_REGMAP_REG(dev, name, addr, width, endian) \
+	dev##_REG_##name = (addr), dev##_WIDTH_##name = (width), \
+	dev##_ENDIAN_##name = (endian),
+
+// Generates the [dev]_[name] descriptor, [dev]_get_[name] and [dev]_set_[name].
+// A register wider than 4 bytes, or a field that does not fit in its
+// register, fails to compile
+#define I2C_REGMAP_FIELD(dev, reg, name, shift, bits) \
+	_Static_assert(dev##_WIDTH_##reg >= 1 && dev##_WIDTH_##reg <= 4, \
+		#dev "_" #reg " must be 1 - 4 bytes wide"); \
+	_Static_assert((shift) + (bits) <= dev##_WIDTH_##reg * 8, \
+		#dev "_" #name " does not fit in " #dev "_" #reg); \
+	static const i2c_field_t dev##_##name = { \
+		dev##_REG_##reg, dev##_WIDTH_##reg, dev##_ENDIAN_##reg, (shift), (bits)}; \
+	__attribute__((always_inline, unused)) \
+	static inline i2c_err_t dev##_get_##name(const i2c_device_t *d, uint32_t *val) \
+		{ return i2c_field_read(d, &dev##_##name, val); } \
+	__attribute__((always_inline, unused)) \
+	static inline i2c_err_t dev##_set_##name(const i2c_device_t *d, const uint32_t val) \
+		{ return i2c_field_write(d, &dev##_##name, val); }
+
+#define I2C_REGMAP(REGS, FIELDS) \
+	enum { REGS(I2C_REGMAP_REG) }; \
+	FIELDS(I2C_REGMAP_FIELD)
+
+
+/*** Transaction Queue *******************************************************/
+#ifdef I2C_QUEUE
+// Requests are queued with i2c_submit() and run by i2c_queue_service(), one
+// transaction (chunk) per call. Urgent requests always run before Background
+// ones, so an urgent request waits at most for the chunk already running.
+// Large transfers are split into chunks that end on [chunk] boundaries of the
+// register address, eg an EEPROM page, so an urgent request can cut in.
+// Requests are owned by the caller, and must stay valid until status is no
+// longer I2C_ERR_BUSY. i2c_submit() may be called from an interrupt
+// Example:
+//   static uint8_t log_buf[255];
+//   static i2c_request_t log_dump =
+//       I2C_REQUEST(&i2c_bus1, 0x50, 0x00, log_buf, 255, I2C_REQ_WRITE, 16);
+//   i2c_submit(&log_dump, I2C_PRIO_BACKGROUND);
+//   while(log_dump.status == I2C_ERR_BUSY) i2c_queue_service();
+
+// How long a chunk is retried while its device NACKs the address after an
+// earlier chunk, eg an EEPROM finishing its page write cycle
+#ifndef I2C_QUEUE_RETRY_MS
+#define I2C_QUEUE_RETRY_MS 10
+#endif
+
+typedef enum {
+	I2C_PRIO_BACKGROUND = 0,
+	I2C_PRIO_URGENT,
+	I2C_PRIO_LEVELS,
+} i2c_prio_t;
+
+// Request Flags
+#define I2C_REQ_READ  0x00
+#define I2C_REQ_WRITE 0x01
+
+typedef struct i2c_request {
+	struct i2c_request *next;     // Used by the Queue
+	i2c_bus_t *bus;               // Bus to use
+	uint8_t   *buf;               // Buffer to read to, or write from
+	uint8_t    addr;              // 7-Bit Device Address
+	uint8_t    reg;               // First Register
+	uint8_t    len;               // Number of bytes to transfer
+	uint8_t    chunk;             // Chunk boundary, eg EEPROM page. 0 for none
+	uint8_t    flags;             // I2C_REQ_READ or I2C_REQ_WRITE
+	uint8_t    done;              // Bytes transferred so far
+	volatile i2c_err_t status;    // I2C_ERR_BUSY until the request finishes
+	uint32_t   queued;            // SysTick Count when submitted
+	uint32_t   retry;             // SysTick Count of the first retried NACK
+	void (*callback)(struct i2c_request *);  // Called when finished, or NULL
+} i2c_request_t;
+
+#define I2C_REQUEST(bus, addr, reg, buf, len, flags, chunk) \
+	{0, (bus), (buf), (addr), (reg), (len), (chunk), (flags), 0, I2C_OK, 0, 0, 0}
+
+// Queue Statistics, in SysTick Counts (DELAY_US_TIME per microsecond).
+// The worst case wait of an urgent request is bounded by chunk_max, plus how
+// often i2c_queue_service() is called
+typedef struct {
+	uint32_t urgent_wait_max;     // Longest submit to first transaction time
+	uint32_t chunk_max;           // Longest single transaction
+	uint32_t urgent_count;        // Urgent requests started
+	uint32_t chunk_count;         // Transactions run
+} i2c_queue_stats_t;
+
+extern i2c_queue_stats_t i2c_queue_stats;
+#endif
+
+
+/*** Slave Mode **************************************************************/
+#ifdef I2C_SLAVE
+// I2C1 answers at a 7-Bit Address and serves a Register Map held in RAM.
+// A write sets the register pointer with its first byte, following bytes are
+// stored from there on. A read returns bytes from the register pointer. The
+// pointer auto-increments and wraps at the end of the map. With an empty map
+// (size 0) writes are ACKed and dropped, and reads return 0xFF.
+// Everything happens in the I2C Interrupts, so the core can sleep with
+// i2c_slave_sleep() until it is addressed. Sleep Mode is used, as the I2C
+// Peripheral is not clocked in Standby
+// Example:
+//   static volatile uint8_t regs[16];
+//   static i2c_slave_t slave = I2C_SLAVE_INIT(0x42, regs, 16, 0);
+//   i2c_slave_init(&slave);
+//   while(1) i2c_slave_sleep();
+typedef struct {
+	volatile uint8_t *regs;     // Register Map
+	uint8_t  size;              // Number of registers in the map
+	uint8_t  addr;              // 7-Bit Own Address
+	uint8_t  general_call;      // 1 to also accept General Call (0x00) writes
+	// Called from the interrupt once a write ends, with the first register
+	// and number of bytes written. gc is 1 for a General Call. May be NULL
+	void (*on_write)(const uint8_t reg, const uint8_t len, const uint8_t gc);
+
+	// Awake Time Counters, in SysTick Counts (DELAY_US_TIME per microsecond).
+	// Awake time is the time spent in the I2C Interrupts
+	volatile uint32_t transactions;   // Completed transactions
+	volatile uint32_t awake_total;    // Total awake time
+	volatile uint32_t awake_last;     // Awake time of the last transaction
+	volatile uint32_t awake_max;      // Longest awake time of one transaction
+
+	// Transaction State, used by the interrupts
+	volatile uint8_t ptr;       // Register Pointer
+	uint8_t  start;             // First register of the current write
+	uint8_t  count;             // Bytes written in the current write
+	uint8_t  state;             // Current transaction state
+	uint8_t  gc;                // Current write is a General Call
+	uint32_t awake;             // Awake time of the current transaction
+} i2c_slave_t;
+
+#define I2C_SLAVE_INIT(addr, regs, size, general_call) \
+	{(regs), (size), (addr), (general_call), 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+#endif
+
 
 /*** Functions ***************************************************************/
+// The transfer entry points are forced inline in the header-only build, -Os
+// would otherwise keep them as calls, and nothing could fold
+#if defined(I2C_INLINE) && !defined(CH32_LIB_I2C_C)
+	#define I2C_API static inline
+	#define I2C_API_HOT static inline __attribute__((always_inline))
+#else
+	#define I2C_API
+	#define I2C_API_HOT
+#endif
+
 /// @brief Initialise the I2C Peripheral on the default pins, in Master Mode
-/// @param clk_rate that the I2C Bus should use in Hz. Max 400000
-/// @return i2c_err_t, I2C_OK On success
-i2c_err_t i2c_init(const uint32_t clk_rate);
+/// @param clk_rate that the I2C Bus should use in Hz. Rounded down to the
+/// nearest rate the hardware can make, see i2c_get_clk_rate()
+/// @return i2c_err_t, I2C_OK On success, I2C_ERR_INVALID if clk_rate is 0
+I2C_API i2c_err_t i2c_init(const uint32_t clk_rate);
 
 /// @brief Pings a specific I2C Address, and returns a i2c_err_t status
 /// @param addr I2C Device Address, MUST BE 7 Bit
 /// @return i2c_err_t, I2C_OK if the device responds
-i2c_err_t i2c_ping(const uint8_t addr);
+I2C_API i2c_err_t i2c_ping(const uint8_t addr);
 
 /// @brief Scans through all 7 Bit addresses, prints any that respond
 /// @param callback function - returns void, takes uint8_t
 /// @return None
-void i2c_scan(void (*callback)(const uint8_t));
+I2C_API void i2c_scan(void (*callback)(const uint8_t));
 
 /// @brief reads [len] bytes from [addr]s [reg] register into [buf]
 /// @param addr, address of I2C Device to Read from, MUST BE 7 Bit
 /// @param buf, buffer to read to
 /// @param len, number of bytes to read
 /// @return 12c_err_t. I2C_OK on Success
-i2c_err_t i2c_read(const uint8_t addr,	const uint8_t reg,
+I2C_API_HOT i2c_err_t i2c_read(const uint8_t addr,	const uint8_t reg,
 										uint8_t *buf,
 										const uint8_t len);
 
@@ -125,8 +853,420 @@ i2c_err_t i2c_read(const uint8_t addr,	const uint8_t reg,
 /// @param buf, Buffer to write from
 /// @param len, number of bytes to read
 /// @return i2c_err_t. I2C_OK On Success.
-i2c_err_t i2c_write(const uint8_t addr,	const uint8_t reg,
+I2C_API_HOT i2c_err_t i2c_write(const uint8_t addr,	const uint8_t reg,
 										const uint8_t *buf,
 										const uint8_t len);
 
+/// @brief Calculates the SCL frequency a CKCFGR value produces. This is the
+/// ideal rate, slow rise times on the bus will lower it - see
+/// i2c_measure_clk_rate()
+/// @param ckcfgr, CKCFGR Register value
+/// @return uint32_t SCL Frequency in Hz
+I2C_API uint32_t i2c_ckcfgr_rate(const uint16_t ckcfgr);
+
+/// @brief Gets the SCL frequency the bus is currently set to
+/// @param None
+/// @return uint32_t SCL Frequency in Hz
+I2C_API uint32_t i2c_get_clk_rate(void);
+
+/// @brief Measures the real SCL frequency by sending [addr] and sampling the
+/// SCL pin while the address byte is clocked out. Lower than
+/// i2c_get_clk_rate() when the bus capacitance stretches the rising edges.
+/// Accuracy depends on the SysTick rate, see FUNCONF_SYSTICK_USE_HCLK
+/// @param addr, 7-Bit Address to send. Does not need to respond
+/// @return uint32_t measured SCL Frequency in Hz, 0 if the bus was busy
+I2C_API uint32_t i2c_measure_clk_rate(const uint8_t addr);
+
+/// @brief Fills out a Device Handle at runtime. Use I2C_DEVICE() instead when
+/// the address and clock rate are constant
+/// @param dev, Device Handle to fill
+/// @param bus, Bus Handle the device is on, eg &i2c_bus1
+/// @param addr, 7-Bit Device Address
+/// @param clk_rate, Bus clock rate in Hz to use for this device
+/// @return i2c_err_t, I2C_ERR_INVALID if clk_rate is 0
+I2C_API i2c_err_t i2c_device_init(i2c_device_t *dev, i2c_bus_t *bus,
+                                                     const uint8_t addr,
+                                                     const uint32_t clk_rate);
+
+/// @brief Pings a Device, at the Devices clock rate
+/// @param dev, Device Handle
+/// @return i2c_err_t, I2C_OK if the device responds
+I2C_API i2c_err_t i2c_dev_ping(const i2c_device_t *dev);
+
+/// @brief reads [len] bytes from the Devices [reg] into [buf], at the Devices
+/// clock rate. Only CKCFGR is reprogrammed when the rate changes
+/// @param dev, Device Handle
+/// @param buf, buffer to read to
+/// @param len, number of bytes to read
+/// @return i2c_err_t. I2C_OK on Success
+I2C_API i2c_err_t i2c_dev_read(const i2c_device_t *dev, const uint8_t reg,
+                                                        uint8_t *buf,
+                                                        const uint8_t len);
+
+/// @brief writes [len] bytes from [buf] to the Devices [reg], at the Devices
+/// clock rate. Only CKCFGR is reprogrammed when the rate changes
+/// @param dev, Device Handle
+/// @param buf, Buffer to write from
+/// @param len, number of bytes to write
+/// @return i2c_err_t. I2C_OK on Success
+I2C_API i2c_err_t i2c_dev_write(const i2c_device_t *dev, const uint8_t reg,
+                                                         const uint8_t *buf,
+                                                         const uint8_t len);
+
+/// @brief Reads a Register Map field from a Device
+/// @param dev, Device Handle
+/// @param field, Field Descriptor, eg &DS3231_SEC_UNITS
+/// @param val, where to store the field, shifted down to bit 0
+/// @return i2c_err_t. I2C_OK on Success, I2C_ERR_INVALID if the register is
+/// not 1 - 4 bytes wide
+I2C_API i2c_err_t i2c_field_read(const i2c_device_t *dev,
+                                 const i2c_field_t *field, uint32_t *val);
+
+/// @brief Writes a Register Map field on a Device. A field narrower than its
+/// register is read, modified and written back, the other bits are kept
+/// @param dev, Device Handle
+/// @param field, Field Descriptor
+/// @param val, new value of the field, extra high bits are dropped
+/// @return i2c_err_t. I2C_OK on Success, I2C_ERR_INVALID if the register is
+/// not 1 - 4 bytes wide
+I2C_API i2c_err_t i2c_field_write(const i2c_device_t *dev,
+                                  const i2c_field_t *field, const uint32_t val);
+
+/// @brief Reads several fields in one transaction. Every register from the
+/// lowest to the highest one used is read in a single burst, then the fields
+/// are extracted from it. Needs a device with register auto-increment
+/// @param dev, Device Handle
+/// @param fields, array of [count] Field Descriptors, in any order
+/// @param count, number of fields
+/// @param vals, array of [count] values to fill in
+/// @return i2c_err_t. I2C_OK on Success, I2C_ERR_INVALID if a field runs
+/// past register 0xFF, or its register is not 1 - 4 bytes wide
+I2C_API i2c_err_t i2c_field_read_group(const i2c_device_t *dev,
+                                       const i2c_field_t *const *fields,
+                                       const uint8_t count, uint32_t *vals);
+
+/// @brief Broadcasts [cmd] then [len] bytes from [buf] to the General Call
+/// Address. Every listening device receives the same message in the same
+/// transaction, so a group of devices can be configured (and latch) together
+/// @param cmd, first byte after the address. Device specific, or I2C_GC_*
+/// @param buf, Buffer to write from, may be NULL if len is 0
+/// @param len, number of bytes to write after cmd
+/// @return i2c_err_t. I2C_OK if at least one device ACKed every byte
+I2C_API i2c_err_t i2c_general_call(const uint8_t cmd, const uint8_t *buf,
+                                                      const uint8_t len);
+
+/// @brief Runs an Init Script (see I2C_SCRIPT_*) until I2C_SCRIPT_END, or
+/// the first error
+/// @param script, const table of I2C_SCRIPT_* steps, normally in flash
+/// @return i2c_err_t. I2C_OK on Success, I2C_ERR_VERIFY if a POLL or VERIFY
+/// step did not match, or the script contains an unknown step
+I2C_API i2c_err_t i2c_run_script(const uint8_t *script);
+
+/// @brief Switches the default bus to another pinout, eg &i2c_pinout_alt_1.
+/// Waits for the bus to be idle, then moves the AFIO Remap and GPIO settings
+/// over without resetting the peripheral. The old pins are left floating.
+/// Can be called before i2c_init() to select the pinout at runtime
+/// @param pinout, Pinout to use
+/// @return i2c_err_t, I2C_ERR_BUSY if a transaction did not finish in time
+I2C_API i2c_err_t i2c_remap(const i2c_pinout_t *pinout);
+
+/// @brief Changes the default busses clock rate without re-initialising it.
+/// Waits for any STOP Condition to finish, the pins are not touched
+/// @param clk_rate, new SCL Frequency in Hz
+/// @return i2c_err_t, I2C_OK on success, I2C_ERR_INVALID if clk_rate is 0
+I2C_API i2c_err_t i2c_set_clk_rate(const uint32_t clk_rate);
+
+/// @brief Recovers the default bus after an error without a full reset.
+/// A device holding SDA low is freed by clocking SCL (up to 9 pulses) and
+/// sending a STOP, then the peripheral logic is reset with SWRST and its
+/// setup put back. The clock, AFIO and GPIO setup are kept
+/// @param None
+/// @return i2c_err_t, I2C_OK if both lines are released afterwards
+I2C_API i2c_err_t i2c_recover(void);
+
+/// @brief Saves the default busses peripheral setup, eg before Standby
+/// @param state, where to store the setup
+/// @return None
+I2C_API void i2c_save(i2c_state_t *state);
+
+/// @brief Restores a setup saved with i2c_save(), eg after waking from
+/// Standby. Re-enables the clocks and brings the peripheral up before the
+/// pins are handed to it, so there is no glitch and no need to wait
+/// @param state, setup to restore
+/// @return None
+I2C_API void i2c_restore(const i2c_state_t *state);
+
+/// @brief Checks the default busses lines for faults. Samples SCL and SDA
+/// for a stuck low line - one low for 2ms - before anything else, so a
+/// shorted line is reported as stuck rather than as a busy bus. Then measures each lines rise time by pulling it low
+/// and timing how long it takes to read High once released. SDA is only
+/// toggled while SCL is low, so no START or STOP is seen by the devices.
+/// The bus must be idle. The time taken by the polling loop itself is
+/// measured first and taken off. Rise times are counted in SysTick Counts
+/// (health->resolution_ns), and a rate is only picked if its limit is met
+/// with one Count to spare - at 166ns that tops out at 600kHz
+/// @param health, results
+/// @return i2c_err_t, I2C_ERR_BUSY if a line is stuck (scl_stuck or
+/// sda_stuck set), or a transaction is still running (neither set)
+I2C_API i2c_err_t i2c_check_bus(i2c_health_t *health);
+
+/// @brief Loads [len] bytes from an EEPROM or FRAM on the default bus into
+/// RAM, in one sequential read starting at [mem_addr]. There is no 255 byte
+/// limit or per-chunk START/STOP. The clock is raised for the load and put
+/// back after. With I2C_DMA the bytes are moved by DMA, and the CRC is
+/// computed behind it. Not supported on a bit-banged bus
+/// @param addr, I2C Device Address, MUST BE 7 Bit
+/// @param mem_addr, Memory Address to start from
+/// @param buf, RAM to load into
+/// @param len, Number of bytes to load, at least 1
+/// @param load, Load setup, and report of the CRC, clock rate and time taken
+/// @return i2c_err_t, I2C_OK on success, I2C_ERR_VERIFY on a CRC mismatch,
+/// I2C_ERR_INVALID if len is 0
+I2C_API i2c_err_t i2c_load(const uint8_t addr, const uint16_t mem_addr,
+                           uint8_t *buf, const uint16_t len, i2c_load_t *load);
+
+/// @brief Computes a CRC-16/CCITT-FALSE (poly 0x1021), the same as i2c_load
+/// @param crc, I2C_CRC16_INIT, or the result of a previous call to continue
+/// @param buf, Data
+/// @param len, Number of bytes
+/// @return uint16_t updated CRC
+I2C_API uint16_t i2c_crc16(uint16_t crc, const uint8_t *buf, uint32_t len);
+
+/*** Bus Functions ***********************************************************/
+// The same as the functions above, on a specific bus. The functions above
+// all use i2c_bus1
+
+/// @brief Initialise a bus in Master Mode, on the busses pinout
+/// @param bus, Bus Handle, eg &i2c_bus1
+/// @param clk_rate that the I2C Bus should use in Hz
+/// @return i2c_err_t, I2C_OK On success, I2C_ERR_INVALID if clk_rate is 0
+I2C_API i2c_err_t i2c_bus_init(i2c_bus_t *bus, const uint32_t clk_rate);
+
+/// @brief Pings a specific I2C Address on a bus
+/// @param bus, Bus Handle
+/// @param addr I2C Device Address, MUST BE 7 Bit
+/// @return i2c_err_t, I2C_OK if the device responds
+I2C_API i2c_err_t i2c_bus_ping(i2c_bus_t *bus, const uint8_t addr);
+
+/// @brief Scans through all 7 Bit addresses on a bus
+/// @param bus, Bus Handle
+/// @param callback function - returns void, takes uint8_t
+/// @return None
+I2C_API void i2c_bus_scan(i2c_bus_t *bus, void (*callback)(const uint8_t));
+
+/// @brief reads [len] bytes from [addr]s [reg] register into [buf]
+/// @param bus, Bus Handle
+/// @param addr, address of I2C Device to Read from, MUST BE 7 Bit
+/// @param buf, buffer to read to
+/// @param len, number of bytes to read
+/// @return i2c_err_t. I2C_OK on Success
+I2C_API_HOT i2c_err_t i2c_bus_read(i2c_bus_t *bus, const uint8_t addr,
+                                               const uint8_t reg,
+                                               uint8_t *buf,
+                                               const uint8_t len);
+
+/// @brief writes [len] bytes from [buf], to the [reg] of [addr]
+/// @param bus, Bus Handle
+/// @param addr, Address of the I2C Device to Write to, MUST BE 7 Bit
+/// @param buf, Buffer to write from
+/// @param len, number of bytes to write
+/// @return i2c_err_t. I2C_OK On Success.
+I2C_API_HOT i2c_err_t i2c_bus_write(i2c_bus_t *bus, const uint8_t addr,
+                                                const uint8_t reg,
+                                                const uint8_t *buf,
+                                                const uint8_t len);
+
+/// @brief Gets the SCL frequency a bus is currently set to
+/// @param bus, Bus Handle
+/// @return uint32_t SCL Frequency in Hz
+I2C_API uint32_t i2c_bus_get_clk_rate(i2c_bus_t *bus);
+
+/// @brief Measures the real SCL frequency of a bus, see i2c_measure_clk_rate
+/// @param bus, Bus Handle
+/// @param addr, 7-Bit Address to send. Does not need to respond
+/// @return uint32_t measured SCL Frequency in Hz, 0 if the bus was busy
+I2C_API uint32_t i2c_bus_measure_clk_rate(i2c_bus_t *bus, const uint8_t addr);
+
+/// @brief General Call broadcast on a bus, see i2c_general_call
+/// @param bus, Bus Handle
+/// @param cmd, first byte after the address
+/// @param buf, Buffer to write from, may be NULL if len is 0
+/// @param len, number of bytes to write after cmd
+/// @return i2c_err_t. I2C_OK if at least one device ACKed every byte
+I2C_API i2c_err_t i2c_bus_general_call(i2c_bus_t *bus, const uint8_t cmd,
+                                                       const uint8_t *buf,
+                                                       const uint8_t len);
+
+/// @brief Runs an Init Script on a bus, see i2c_run_script
+/// @param bus, Bus Handle
+/// @param script, const table of I2C_SCRIPT_* steps
+/// @return i2c_err_t. I2C_OK on Success
+I2C_API i2c_err_t i2c_bus_run_script(i2c_bus_t *bus, const uint8_t *script);
+
+/// @brief Switches a bus to another pinout, see i2c_remap
+/// @param bus, Bus Handle
+/// @param pinout, Pinout to use. Must be one the busses peripheral can use
+/// @return i2c_err_t, I2C_OK on success
+I2C_API i2c_err_t i2c_bus_remap(i2c_bus_t *bus, const i2c_pinout_t *pinout);
+
+/// @brief Changes a busses clock rate, see i2c_set_clk_rate
+/// @param bus, Bus Handle
+/// @param clk_rate, new SCL Frequency in Hz
+/// @return i2c_err_t, I2C_OK on success
+I2C_API i2c_err_t i2c_bus_set_clk_rate(i2c_bus_t *bus, const uint32_t clk_rate);
+
+/// @brief Recovers a bus after an error, see i2c_recover
+/// @param bus, Bus Handle
+/// @return i2c_err_t, I2C_OK if both lines are released afterwards
+I2C_API i2c_err_t i2c_bus_recover(i2c_bus_t *bus);
+
+/// @brief Saves a busses peripheral setup, see i2c_save. With I2C_LOCK,
+/// nothing is saved if the Bus Lock can not be taken
+/// @param bus, Bus Handle
+/// @param state, where to store the setup
+/// @return None
+I2C_API void i2c_bus_save(i2c_bus_t *bus, i2c_state_t *state);
+
+/// @brief Restores a busses peripheral setup, see i2c_restore. With
+/// I2C_LOCK, nothing is restored if the Bus Lock can not be taken
+/// @param bus, Bus Handle
+/// @param state, setup to restore
+/// @return None
+I2C_API void i2c_bus_restore(i2c_bus_t *bus, const i2c_state_t *state);
+
+/// @brief Sets the PFIC Priority of a busses Event and Error Interrupts.
+/// The defaults are I2C_IRQ_EV_PRIORITY and I2C_IRQ_ER_PRIORITY
+/// @param bus, Bus Handle of a hardware bus
+/// @param ev_prio, Event Interrupt priority, lower is served first
+/// @param er_prio, Error Interrupt priority
+/// @return None
+I2C_API void i2c_bus_irq_priority(i2c_bus_t *bus, const uint8_t ev_prio,
+                                                  const uint8_t er_prio);
+
+/// @brief Checks a busses lines for faults, see i2c_check_bus
+/// @param bus, Bus Handle
+/// @param health, results
+/// @return i2c_err_t, I2C_OK if both lines are healthy
+I2C_API i2c_err_t i2c_bus_check(i2c_bus_t *bus, i2c_health_t *health);
+
+/// @brief Loads a range of an EEPROM or FRAM into RAM, see i2c_load
+/// @param bus, Bus Handle of a hardware bus
+/// @param addr, I2C Device Address, MUST BE 7 Bit
+/// @param mem_addr, Memory Address to start from
+/// @param buf, RAM to load into
+/// @param len, Number of bytes to load
+/// @param load, Load setup and report
+/// @return i2c_err_t, I2C_OK on success
+I2C_API i2c_err_t i2c_bus_load(i2c_bus_t *bus, const uint8_t addr,
+                                               const uint16_t mem_addr,
+                                               uint8_t *buf,
+                                               const uint16_t len,
+                                               i2c_load_t *load);
+
+/// @brief Starts a Bulk Load and returns once the memory has accepted the
+/// read. With I2C_DMA the data then arrives in the background, so the CPU is
+/// free until i2c_bus_load_finish(), eg to program the previous block into
+/// flash. Without I2C_DMA the bytes are read by i2c_bus_load_finish().
+/// [buf] must not be touched until then
+/// @param bus, addr, mem_addr, buf, len, load - see i2c_bus_load
+/// @return i2c_err_t, I2C_OK if the read started. Errors are also kept in
+/// [load], i2c_bus_load_finish() must be called either way
+I2C_API i2c_err_t i2c_bus_load_start(i2c_bus_t *bus, const uint8_t addr,
+                                                     const uint16_t mem_addr,
+                                                     uint8_t *buf,
+                                                     const uint16_t len,
+                                                     i2c_load_t *load);
+
+/// @brief Waits for a Bulk Load started with i2c_bus_load_start(), computes
+/// the CRC, sends the STOP and fills in the report. Takes the same arguments
+/// @param bus, addr, mem_addr, buf, len, load - see i2c_bus_load
+/// @return i2c_err_t, I2C_OK on success
+I2C_API i2c_err_t i2c_bus_load_finish(i2c_bus_t *bus, const uint8_t addr,
+                                                      const uint16_t mem_addr,
+                                                      uint8_t *buf,
+                                                      const uint16_t len,
+                                                      i2c_load_t *load);
+
+#ifdef I2C_FAULT
+/// @brief Arms a fault for the next transactions on any hardware bus.
+/// Replaces any fault still armed
+/// @param fault, Fault to inject
+/// @return None
+I2C_API void i2c_fault_inject(const i2c_fault_t *fault);
+#endif
+
+#ifdef I2C_LOCK
+/// @brief Takes a busses lock, so a group of transactions runs without
+/// another context using the bus in between. Every transaction takes the lock
+/// too, the same context can take it again (nested) but the main loop and
+/// each Interrupt level are different contexts. Must be released with
+/// i2c_bus_unlock() as many times as it was taken
+/// @param bus, Bus Handle
+/// @param timeout_us, time to wait for another context to release it.
+/// 0 tries once. Waiting from an Interrupt on the main loop can never succeed
+/// @return i2c_err_t, I2C_OK if taken, I2C_ERR_BUSY if not
+I2C_API i2c_err_t i2c_bus_lock(i2c_bus_t *bus, const uint32_t timeout_us);
+
+/// @brief Releases one take of a busses lock. Does nothing unless called
+/// from the context that holds it
+/// @param bus, Bus Handle
+/// @return None
+I2C_API void i2c_bus_unlock(i2c_bus_t *bus);
+#endif
+
+#ifdef I2C_TRACE
+/// @brief Clears all records from the Transaction Trace ring
+/// @param None
+/// @return None
+I2C_API void i2c_trace_clear(void);
+#endif
+
+#ifdef I2C_BRIDGE
+/// @brief Runs a batch of operations posted by minichlink, if there is one.
+/// Call from the main loop
+/// @param None
+/// @return uint8_t, 1 if a batch was run
+I2C_API uint8_t i2c_bridge_poll(void);
+#endif
+
+#ifdef I2C_SLAVE
+/// @brief Initialises I2C1 in Slave Mode on the default pinout, serving
+/// [slave]s Register Map from the I2C Interrupts. General Call writes are
+/// accepted if slave->general_call is set
+/// @param slave, Slave Handle, must stay valid while Slave Mode is used
+/// @return i2c_err_t, I2C_OK on success
+I2C_API i2c_err_t i2c_slave_init(i2c_slave_t *slave);
+
+/// @brief Sleeps the core until the next interrupt, eg an I2C Address Match.
+/// Call in a loop from main
+/// @param None
+/// @return None
+I2C_API void i2c_slave_sleep(void);
+#endif
+
+#ifdef I2C_QUEUE
+/// @brief Adds a request to the end of the queue for its priority
+/// @param req, Request to queue. status is set to I2C_ERR_BUSY
+/// @param prio, I2C_PRIO_URGENT or I2C_PRIO_BACKGROUND
+/// @return i2c_err_t, I2C_ERR_BUSY if the request is already queued
+I2C_API i2c_err_t i2c_submit(i2c_request_t *req, const i2c_prio_t prio);
+
+/// @brief Runs the next chunk of the highest priority queued request. Call
+/// from the main loop, or a timer interrupt
+/// @param None
+/// @return uint8_t, 1 if requests are still queued
+I2C_API uint8_t i2c_queue_service(void);
+#endif
+
+// Header-only build, pull in the definitions. If lib_i2c.c is being compiled
+// on its own, it has nothing to add - the shared state is defined by the file
+// with I2C_IMPLEMENTATION
+#ifdef I2C_INLINE
+	#ifndef CH32_LIB_I2C_C
+		#include "lib_i2c.c"
+	#else
+		#define I2C_INLINE_UNUSED
+	#endif
+#endif
+
 #endif
@@ -9,6 +9,8 @@
 * Copyright ADBeta (c) 2024
 ******************************************************************************/
 #include "ch32v003fun.h"
+// Holds the lib_i2c state when built header-only (I2C_INLINE)
+#define I2C_IMPLEMENTATION
 #include "lib_i2c.h"
 
 #include <stdio.h>
@@ -60,7 +62,31 @@ int main()
 	// Example to read from the I2C Device
 	uint8_t seconds = 0;    // Just Seconds (Read as Hex instead od Decimal)
 	uint8_t time[3] = {0};  // Time in Sec, Min, Hrs (Hex not Decimal)
-	
+
+	#ifdef I2C_FAULT
+	// Fault Recovery Benchmark. Fails 3 transactions with each fault type,
+	// retrying with a bus recovery until a read succeeds again
+	printf("----Fault Recovery----\n");
+	for(i2c_fault_type_t type = I2C_FAULT_NACK; type < I2C_FAULT_TYPES; type++)
+	{
+		const i2c_phase_t phase = (type == I2C_FAULT_SDA_STUCK) ? I2C_PHASE_IDLE
+		                                                         : I2C_PHASE_ADDR;
+		i2c_fault_inject(&(i2c_fault_t){type, phase, 0, 3});
+		while(i2c_read(I2C_ADDR, 0x00, &seconds, 1) != I2C_OK) i2c_recover();
+
+		printf("Fault %d: Lost %lu, Recovery %luus\n", type,
+		       (unsigned long)i2c_fault_stats[type].lost,
+		       (unsigned long)i2c_fault_stats[type].recover_us_max);
+	}
+
+	// A NACKed Register Byte must fail before any data, even with no data
+	i2c_fault_inject(&(i2c_fault_t){I2C_FAULT_NACK, I2C_PHASE_REG, 0, 1});
+	i2c_stat = i2c_write(I2C_ADDR, 0x00, NULL, 0);
+	if(i2c_stat != I2C_ERR_NACK || i2c_bus1.result.phase != I2C_PHASE_REG)
+		printf("Register NACK reported in phase %d\n", i2c_bus1.result.phase);
+	printf("----Done----\n\n");
+	#endif
+
 	// Loop forever
 	while(1)
 	{
@@ -0,0 +1,135 @@
+/* Single-File-Header for sharing the DMA1 Channels and their interrupts between
+   libraries, eg lib_i2c and the ws2812b DMA LED Driver.
+
+   Each library claims the channels it uses before it uses them. A second
+   claim on the same channel by a different owner fails, so conflicts are
+   found up front instead of as corrupted transfers. Owners are matched by
+   pointer, so pass the same string every time. This file defines the interrupt handlers
+   for all DMA1 Channels, and calls the callback registered with the claim.
+   Do not define DMA1_ChannelX_IRQHandler yourself when using it.
+
+   If you are including this in main, simply
+	#define CH32V003_DMA_IMPLEMENTATION
+
+   Then, in a library or main:
+	if( DMAClaim( 3, "ws2812b", MyCallback, 0 ) ) { ...channel is taken... }
+
+   The callback is run from the DMA Interrupt, with the channels INTFR bits
+   (eg DMA1_IT_TC3 | DMA1_IT_HT3). The flags are cleared before it is called.
+	void MyCallback( int channel, uint32_t flags, void * ctx );
+
+   Fixed channel requests on the CH32V003:
+	1: ADC1           2: SPI1_RX    3: SPI1_TX          4: USART1_TX
+	5: USART1_RX      6: I2C1_TX    7: I2C1_RX
+*/
+
+#ifndef CH32V003_DMA_H
+#define CH32V003_DMA_H
+
+#include <stdint.h>
+#include "ch32v003fun.h"
+
+#define DMA_CHANNELS 7
+
+typedef void (*DMACallback_t)( int channel, uint32_t flags, void * ctx );
+
+// Claims a DMA1 Channel (1 to 7) for [owner], and enables its clock. If
+// [callback] is not NULL, the channels interrupt is enabled and its events
+// are passed to it. Claiming a channel again with the same owner updates the
+// callback. Returns 0 on success, -1 if a different owner holds the channel.
+int DMAClaim( int channel, const char * owner, DMACallback_t callback, void * ctx );
+
+// Releases a channel, disables it and its interrupt.
+void DMARelease( int channel );
+
+// Gets the owner of a channel, or NULL if it is free.
+const char * DMAOwner( int channel );
+
+// Gets the registers of a DMA1 Channel (1 to 7).
+#define DMAChannel( channel ) \
+	((DMA_Channel_TypeDef *)(DMA1_Channel1_BASE + ((channel) - 1) * 0x14))
+
+#ifdef CH32V003_DMA_IMPLEMENTATION
+
+static const char * DMAOwners[DMA_CHANNELS];
+static DMACallback_t DMACallbacks[DMA_CHANNELS];
+static void * DMAContexts[DMA_CHANNELS];
+
+int DMAClaim( int channel, const char * owner, DMACallback_t callback, void * ctx )
+{
+	if( channel < 1 || channel > DMA_CHANNELS ) return -1;
+
+	const int idx = channel - 1;
+
+	// Check and take the channel in one go, leaving interrupts as they were
+	const uint32_t mstatus = __get_MSTATUS();
+	__disable_irq();
+	if( DMAOwners[idx] && DMAOwners[idx] != owner )
+	{
+		__set_MSTATUS( mstatus );
+		return -1;
+	}
+	DMAOwners[idx] = owner;
+	DMACallbacks[idx] = callback;
+	DMAContexts[idx] = ctx;
+	__set_MSTATUS( mstatus );
+
+	RCC->AHBPCENR |= RCC_AHBPeriph_DMA1;
+
+	if( callback ) NVIC_EnableIRQ( DMA1_Channel1_IRQn + idx );
+	return 0;
+}
+
+void DMARelease( int channel )
+{
+	if( channel < 1 || channel > DMA_CHANNELS ) return;
+
+	const int idx = channel - 1;
+	NVIC_DisableIRQ( DMA1_Channel1_IRQn + idx );
+	DMAChannel( channel )->CFGR &= ~DMA_CFGR1_EN;
+
+	const uint32_t mstatus = __get_MSTATUS();
+	__disable_irq();
+	DMAOwners[idx] = 0;
+	DMACallbacks[idx] = 0;
+	__set_MSTATUS( mstatus );
+}
+
+const char * DMAOwner( int channel )
+{
+	if( channel < 1 || channel > DMA_CHANNELS ) return 0;
+	return DMAOwners[channel - 1];
+}
+
+// Shared Dispatch. Clears and passes on flags until the channel is quiet.
+static inline void DMADispatch( int channel )
+{
+	const int shift = ( channel - 1 ) * 4;
+	uint32_t flags = DMA1->INTFR & ( 0xf << shift );
+	while( flags )
+	{
+		DMA1->INTFCR = flags;
+		if( DMACallbacks[channel - 1] )
+			DMACallbacks[channel - 1]( channel, flags, DMAContexts[channel - 1] );
+		flags = DMA1->INTFR & ( 0xf << shift );
+	}
+}
+
+void DMA1_Channel1_IRQHandler( void ) __attribute__((interrupt));
+void DMA1_Channel1_IRQHandler( void ) { DMADispatch( 1 ); }
+void DMA1_Channel2_IRQHandler( void ) __attribute__((interrupt));
+void DMA1_Channel2_IRQHandler( void ) { DMADispatch( 2 ); }
+void DMA1_Channel3_IRQHandler( void ) __attribute__((interrupt));
+void DMA1_Channel3_IRQHandler( void ) { DMADispatch( 3 ); }
+void DMA1_Channel4_IRQHandler( void ) __attribute__((interrupt));
+void DMA1_Channel4_IRQHandler( void ) { DMADispatch( 4 ); }
+void DMA1_Channel5_IRQHandler( void ) __attribute__((interrupt));
+void DMA1_Channel5_IRQHandler( void ) { DMADispatch( 5 ); }
+void DMA1_Channel6_IRQHandler( void ) __attribute__((interrupt));
+void DMA1_Channel6_IRQHandler( void ) { DMADispatch( 6 ); }
+void DMA1_Channel7_IRQHandler( void ) __attribute__((interrupt));
+void DMA1_Channel7_IRQHandler( void ) { DMADispatch( 7 ); }
+
+#endif
+
+#endif
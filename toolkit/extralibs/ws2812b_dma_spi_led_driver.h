@@ -16,11 +16,16 @@
 	#define WSGRB
 	#define WS2812B_ALLOW_INTERRUPT_NESTING
 
+   If ch32v003_DMA.h is included first, DMA1_Channel3 is claimed through it
+   instead of this file defining DMA1_Channel3_IRQHandler, so other libraries
+   can use DMA at the same time.
+
    You will need to implement the following two functions, as callbacks from the ISR.
 	uint32_t WS2812BLEDCallback( int ledno );
 
    You willalso need to call
 	WS2812BDMAInit();
+   It returns 0, or -1 if DMA1_Channel3 is already claimed by another library.
 
    Then, whenyou want to update the LEDs, call:
 	WS2812BDMAStart( int num_leds );
@@ -32,7 +37,8 @@
 #include <stdint.h>
 
 // Use DMA and SPI to stream out WS2812B LED Data via the MOSI pin.
-void WS2812BDMAInit( );
+// Returns 0 on success, -1 if the DMA Channel is taken.
+int WS2812BDMAInit( );
 void WS2812BDMAStart( int leds );
 
 // Callbacks that you must implement.
@@ -172,6 +178,31 @@ static void WS2812FillBuffSec( uint16_t * ptr, int numhalfwords, int tce )
 	WS2812LEDPlace = place;
 }
 
+static inline void WS2812BDMAService( int intfr )
+{
+	// Strange note: These are backwards.  DMA1_IT_HT3 should be HALF and
+	// DMA1_IT_TC3 should be COMPLETE.  But for some reason, doing this causes
+	// LED jitter.  I am henseforth flipping the order.
+
+	if( intfr & DMA1_IT_HT3 )
+	{
+		// Halfwaay (Fill in first part)
+		WS2812FillBuffSec( WS2812dmabuff, DMA_BUFFER_LEN / 2, 1 );
+	}
+	if( intfr & DMA1_IT_TC3 )
+	{
+		// Complete (Fill in second part)
+		WS2812FillBuffSec( WS2812dmabuff + DMA_BUFFER_LEN / 2, DMA_BUFFER_LEN / 2, 0 );
+	}
+}
+
+#ifdef CH32V003_DMA_H
+// Called from the shared DMA1_Channel3 handler in ch32v003_DMA.h
+static void WS2812BDMAEvent( int channel, uint32_t flags, void * ctx )
+{
+	WS2812BDMAService( flags );
+}
+#else
 void DMA1_Channel3_IRQHandler( void ) __attribute__((interrupt));
 void DMA1_Channel3_IRQHandler( void ) 
 {
@@ -183,26 +214,13 @@ void DMA1_Channel3_IRQHandler( void )
 	{
 		// Clear all possible flags.
 		DMA1->INTFCR = DMA1_IT_GL3;
-
-		// Strange note: These are backwards.  DMA1_IT_HT3 should be HALF and
-		// DMA1_IT_TC3 should be COMPLETE.  But for some reason, doing this causes
-		// LED jitter.  I am henseforth flipping the order.
-
-		if( intfr & DMA1_IT_HT3 )
-		{
-			// Halfwaay (Fill in first part)
-			WS2812FillBuffSec( WS2812dmabuff, DMA_BUFFER_LEN / 2, 1 );
-		}
-		if( intfr & DMA1_IT_TC3 )
-		{
-			// Complete (Fill in second part)
-			WS2812FillBuffSec( WS2812dmabuff + DMA_BUFFER_LEN / 2, DMA_BUFFER_LEN / 2, 0 );
-		}
+		WS2812BDMAService( intfr );
 		intfr = DMA1->INTFR;
 	} while( intfr );
 
 	//GPIOD->BSHR = 1<<16; // Turn off GPIOD0 for profiling
 }
+#endif
 
 void WS2812BDMAStart( int leds )
 {
@@ -222,8 +240,13 @@ void WS2812BDMAStart( int leds )
 	DMA1_Channel3->CFGR |= DMA_Mode_Circular;
 }
 
-void WS2812BDMAInit( )
+int WS2812BDMAInit( )
 {
+#ifdef CH32V003_DMA_H
+	// DMA1_Channel3 is SPI1_TX. Give up if another library already uses it.
+	if( DMAClaim( 3, "ws2812b", WS2812BDMAEvent, 0 ) ) return -1;
+#endif
+
 	// Enable DMA + Peripherals
 	RCC->AHBPCENR |= RCC_AHBPeriph_DMA1;
 	RCC->APB2PCENR |= RCC_APB2Periph_GPIOC | RCC_APB2Periph_SPI1;
@@ -260,13 +283,16 @@ void WS2812BDMAInit( )
 		DMA_IT_TC | DMA_IT_HT; // Transmission Complete + Half Empty Interrupts. 
 
 //	NVIC_SetPriority( DMA1_Channel3_IRQn, 0<<4 ); //We don't need to tweak priority.
+#ifndef CH32V003_DMA_H
 	NVIC_EnableIRQ( DMA1_Channel3_IRQn );
+#endif
 	DMA1_Channel3->CFGR |= DMA_CFGR1_EN;
 
 #ifdef WS2812B_ALLOW_INTERRUPT_NESTING
 	__set_INTSYSCR( __get_INTSYSCR() | 2 ); // Enable interrupt nesting.
 	PFIC->IPRIOR[24] = 0b10000000; // Turn on preemption for DMA1Ch3
 #endif
+	return 0;
 }
 
 #endif